@@ -7,27 +7,51 @@
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/parseutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/display.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersrc.h>
+#include <libavfilter/buffersink.h>
 #include <png.h>
+#include <zlib.h>
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#ifdef HAVE_WEBP
+#include <webp/encode.h>
+#include <webp/mux.h>
+#endif
+#ifdef HAVE_XXHASH
+#include <xxhash.h>
+#endif
 #include <time.h>
 #include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <math.h>
+#include <ctype.h>
 #include <dirent.h>
+#include <utime.h>
+#include <fcntl.h>
 
 #ifdef _WIN32
 #include <windows.h>
 #include <direct.h>
+#include <sys/stat.h>
 #define PATH_SEP '\\'
 #define PATH_SEP_STR "\\"
 #define MKDIR(p) _mkdir(p)
+#define NULL_DEVICE "NUL"
+#include <io.h>
 #else
 #include <sys/time.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #define PATH_SEP '/'
 #define PATH_SEP_STR "/"
 #define MKDIR(p) mkdir(p, 0777)
+#define NULL_DEVICE "/dev/null"
 #endif
 
 // ==================== TIMING ====================
@@ -65,14 +89,344 @@ static double timer_elapsed(Timer start) {
 }
 #endif
 
+// ==================== ALLOCATION PROFILING ====================
+
+// Stages that allocations are charged to. Each thread tags itself with the
+// stage it is currently running so the interposed allocator can attribute
+// bytes without any locking. Threads we don't own (FFmpeg's decoder pool)
+// are charged to "other".
+enum {
+    ALLOC_STAGE_OTHER = 0,
+    ALLOC_STAGE_DEMUX,
+    ALLOC_STAGE_DECODE,
+    ALLOC_STAGE_FILTER,
+    ALLOC_STAGE_QUEUE,
+    ALLOC_STAGE_CONVERT,
+    ALLOC_STAGE_ENCODE,
+    ALLOC_STAGE_COUNT
+};
+
+static const char* alloc_stage_names[ALLOC_STAGE_COUNT] = {
+    "other", "demux", "decode", "filter", "queue", "convert", "encode"
+};
+
+static int alloc_profiling = 0;
+static __thread int alloc_stage = ALLOC_STAGE_OTHER;
+
+static uint64_t alloc_calls[ALLOC_STAGE_COUNT];
+static uint64_t alloc_bytes[ALLOC_STAGE_COUNT];
+static int64_t alloc_live_bytes = 0;
+static int64_t alloc_peak_live_bytes = 0;
+
+#define ALLOC_STAGE(s) (alloc_stage = (s))
+
+static void alloc_account(size_t usable, size_t requested) {
+    int stage = alloc_stage;
+    __atomic_fetch_add(&alloc_calls[stage], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_bytes[stage], requested, __ATOMIC_RELAXED);
+
+    int64_t live = __atomic_add_fetch(&alloc_live_bytes, (int64_t)usable, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&alloc_peak_live_bytes, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&alloc_peak_live_bytes, &peak, live, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void alloc_release(size_t usable) {
+    __atomic_fetch_sub(&alloc_live_bytes, (int64_t)usable, __ATOMIC_RELAXED);
+}
+
+// On glibc we interpose the allocator itself, which also catches FFmpeg's
+// av_malloc (posix_memalign) and libpng's internal allocations. Elsewhere
+// only the RSS sampler below is available.
+//
+// Blocks allocated while profiling carry a header just before the pointer
+// handed out: a tag derived from that pointer, the distance back to the
+// libc block and the profiling run. Only tagged blocks of the current run
+// are subtracted on free, so memory allocated before alloc_profile_start
+// can't drive the live count negative.
+#if defined(__GLIBC__) && !defined(NO_ALLOC_INTERPOSE)
+#include <malloc.h>
+#define ALLOC_INTERPOSED 1
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void* ptr);
+
+#define ALLOC_HEADER 16              // keeps malloc's 16-byte alignment
+#define ALLOC_MAX_OFFSET (1 << 20)
+#define ALLOC_TAG 0x70726f66696c6564ULL
+
+typedef struct {
+    uint64_t tag;          // ALLOC_TAG ^ the pointer handed out
+    uint32_t offset;       // from the libc block to that pointer
+    uint32_t generation;   // profiling run that allocated it
+} AllocHeader;
+
+static uint32_t alloc_generation = 0;
+
+static AllocHeader* alloc_header(void* ptr) {
+    return (AllocHeader*)((uint8_t*)ptr - ALLOC_HEADER);
+}
+
+static void* alloc_tag(void* raw, size_t offset, uint32_t generation) {
+    uint8_t* p = (uint8_t*)raw + offset;
+    AllocHeader* h = alloc_header(p);
+    h->tag = ALLOC_TAG ^ (uint64_t)(uintptr_t)p;
+    h->offset = (uint32_t)offset;
+    h->generation = generation;
+    return p;
+}
+
+// The libc block behind a tagged pointer, or NULL for a plain allocation
+// (whose preceding bytes are malloc's own chunk header).
+static void* alloc_untag(void* ptr, size_t* offset, uint32_t* generation) {
+    const AllocHeader* h = alloc_header(ptr);
+    if (h->tag != (ALLOC_TAG ^ (uint64_t)(uintptr_t)ptr)) return NULL;
+    if (h->offset < ALLOC_HEADER || h->offset > ALLOC_MAX_OFFSET || (h->offset & (h->offset - 1))) {
+        return NULL;
+    }
+    *offset = h->offset;
+    *generation = h->generation;
+    return (uint8_t*)ptr - h->offset;
+}
+
+static void* alloc_profiled(void* raw, size_t offset, size_t requested) {
+    if (!raw) return NULL;
+    alloc_account(malloc_usable_size(raw) - offset, requested);
+    return alloc_tag(raw, offset, alloc_generation);
+}
+
+void* malloc(size_t size) {
+    if (!alloc_profiling) return __libc_malloc(size);
+    if (size > SIZE_MAX - ALLOC_HEADER) return NULL;
+    return alloc_profiled(__libc_malloc(size + ALLOC_HEADER), ALLOC_HEADER, size);
+}
+
+void* calloc(size_t n, size_t size) {
+    if (!alloc_profiling) return __libc_calloc(n, size);
+    if (size && n > (SIZE_MAX - ALLOC_HEADER) / size) return NULL;
+    return alloc_profiled(__libc_calloc(1, n * size + ALLOC_HEADER), ALLOC_HEADER, n * size);
+}
+
+void free(void* ptr) {
+    if (!ptr) return;
+    size_t offset;
+    uint32_t generation;
+    void* raw = alloc_untag(ptr, &offset, &generation);
+    if (!raw) {
+        __libc_free(ptr);
+        return;
+    }
+    if (alloc_profiling && generation == alloc_generation) {
+        alloc_release(malloc_usable_size(raw) - offset);
+    }
+    alloc_header(ptr)->tag = 0;
+    __libc_free(raw);
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (!ptr) return malloc(size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    size_t offset;
+    uint32_t generation;
+    void* raw = alloc_untag(ptr, &offset, &generation);
+    if (!raw) {
+        if (!alloc_profiling) return __libc_realloc(ptr, size);
+        // A block from before profiling: move it into a tagged one
+        void* p = malloc(size);
+        if (p) {
+            size_t old = malloc_usable_size(ptr);
+            memcpy(p, ptr, old < size ? old : size);
+            __libc_free(ptr);
+        }
+        return p;
+    }
+
+    if (size > SIZE_MAX - offset) return NULL;
+    size_t old_usable = malloc_usable_size(raw) - offset;
+    void* grown = __libc_realloc(raw, size + offset);
+    if (!grown) return NULL;
+    if (alloc_profiling && generation == alloc_generation) alloc_release(old_usable);
+    if (alloc_profiling) {
+        alloc_account(malloc_usable_size(grown) - offset, size);
+        generation = alloc_generation;
+    }
+    return alloc_tag(grown, offset, generation);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    if (!alloc_profiling) return __libc_memalign(alignment, size);
+    // The header takes a whole alignment unit so the pointer stays aligned
+    size_t offset = ALLOC_HEADER;
+    while (offset < alignment && offset < ALLOC_MAX_OFFSET) offset <<= 1;
+    if (offset < alignment || size > SIZE_MAX - offset) return NULL;
+    return alloc_profiled(__libc_memalign(alignment, size + offset), offset, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void* p = memalign(alignment, size);
+    if (!p) return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+#else
+#define ALLOC_INTERPOSED 0
+#endif
+
+// ---- RSS sampling ----
+
+#define RSS_MAX_SAMPLES 4096
+#define RSS_SAMPLE_INTERVAL_MS 50
+
+typedef struct {
+    pthread_t thread;
+    volatile int running;
+    Timer start;
+    int count;
+    double times[RSS_MAX_SAMPLES];
+    long rss_kb[RSS_MAX_SAMPLES];
+    long peak_kb;
+    double peak_time;
+} RssSampler;
+
+static RssSampler rss_sampler;
+
+static long read_rss_kb() {
+#ifdef __linux__
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (!fp) return -1;
+    long size_pages = 0, resident_pages = 0;
+    int ok = fscanf(fp, "%ld %ld", &size_pages, &resident_pages) == 2;
+    fclose(fp);
+    if (!ok) return -1;
+    return resident_pages * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    return -1;
+#endif
+}
+
+static void* rss_sampler_thread(void* arg) {
+    RssSampler* rs = (RssSampler*)arg;
+
+    while (rs->running) {
+        long kb = read_rss_kb();
+        if (kb < 0) break;
+
+        double t = timer_elapsed(rs->start);
+        if (kb > rs->peak_kb) {
+            rs->peak_kb = kb;
+            rs->peak_time = t;
+        }
+        if (rs->count < RSS_MAX_SAMPLES) {
+            rs->times[rs->count] = t;
+            rs->rss_kb[rs->count] = kb;
+            rs->count++;
+        }
+        usleep(RSS_SAMPLE_INTERVAL_MS * 1000);
+    }
+    return NULL;
+}
+
+// Starts counting allocations and sampling RSS. Everything allocated before
+// this call (option parsing, demuxer probing) is left out of the report.
+static void alloc_profile_start() {
+#if ALLOC_INTERPOSED
+    alloc_generation++;
+#endif
+    memset(alloc_calls, 0, sizeof(alloc_calls));
+    memset(alloc_bytes, 0, sizeof(alloc_bytes));
+    alloc_live_bytes = 0;
+    alloc_peak_live_bytes = 0;
+    alloc_profiling = 1;
+
+    memset(&rss_sampler, 0, sizeof(rss_sampler));
+    timer_start(&rss_sampler.start);
+    rss_sampler.running = 1;
+    pthread_create(&rss_sampler.thread, NULL, rss_sampler_thread, &rss_sampler);
+}
+
+static void alloc_profile_stop() {
+    alloc_profiling = 0;
+    rss_sampler.running = 0;
+    pthread_join(rss_sampler.thread, NULL);
+}
+
+static void alloc_profile_report(int frames) {
+    printf("\n🧠 === ALLOCATION PROFILE ===\n");
+
+    if (ALLOC_INTERPOSED) {
+        uint64_t total_calls = 0, total_bytes = 0;
+        printf("   %-8s %12s %14s %12s %14s\n",
+               "stage", "allocs", "bytes", "allocs/frm", "bytes/frm");
+        for (int s = 0; s < ALLOC_STAGE_COUNT; s++) {
+            total_calls += alloc_calls[s];
+            total_bytes += alloc_bytes[s];
+            printf("   %-8s %12llu %14llu %12.1f %14.0f\n", alloc_stage_names[s],
+                   (unsigned long long)alloc_calls[s], (unsigned long long)alloc_bytes[s],
+                   frames > 0 ? (double)alloc_calls[s] / frames : 0.0,
+                   frames > 0 ? (double)alloc_bytes[s] / frames : 0.0);
+        }
+        printf("   %-8s %12llu %14llu %12.1f %14.0f\n", "total",
+               (unsigned long long)total_calls, (unsigned long long)total_bytes,
+               frames > 0 ? (double)total_calls / frames : 0.0,
+               frames > 0 ? (double)total_bytes / frames : 0.0);
+        printf("   Peak live heap: %.1f MB\n", alloc_peak_live_bytes / (1024.0 * 1024.0));
+    } else {
+        printf("   Allocator interposition not available on this platform (RSS only)\n");
+    }
+
+    if (rss_sampler.count == 0) {
+        printf("   RSS sampling not available on this platform\n");
+        return;
+    }
+
+    printf("   Peak RSS: %.1f MB at %.2fs\n", rss_sampler.peak_kb / 1024.0, rss_sampler.peak_time);
+    printf("   RSS over time:\n");
+    int step = (rss_sampler.count + 9) / 10;
+    for (int i = 0; i < rss_sampler.count; i += step) {
+        printf("     %7.2fs  %8.1f MB\n", rss_sampler.times[i], rss_sampler.rss_kb[i] / 1024.0);
+    }
+    int last = rss_sampler.count - 1;
+    if (last % step != 0) {
+        printf("     %7.2fs  %8.1f MB\n", rss_sampler.times[last], rss_sampler.rss_kb[last] / 1024.0);
+    }
+}
+
 // ==================== PROGRESS BAR ====================
 
+// -progress-json: one JSON object per line for orchestrators, next to (or,
+// with -quiet, instead of) the progress bar.
+static FILE* progress_json = NULL;
+static pthread_mutex_t progress_json_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int progress_quiet = 0;
+
+// Counters are updated with atomics; the mutex is only taken to draw, at
+// most every 0.1 s, so savers don't serialize on it.
 typedef struct {
     Timer start_time;
     int total_frames;
     int frames_processed;
     int audio_packets;
+    int64_t bytes_written;     // only counted with -progress-json
+    const int* decoded;        // frames handed to the savers, NULL if unknown
+    const int* queue_depth;    // frames waiting for a saver, NULL if unknown
     int width;
+    int silent;
     double last_display_time;
     pthread_mutex_t progress_mutex;
 } ProgressTracker;
@@ -82,38 +436,99 @@ static void progress_init(ProgressTracker* pt, int total_frames) {
     pt->total_frames = total_frames;
     pt->frames_processed = 0;
     pt->audio_packets = 0;
+    pt->bytes_written = 0;
+    pt->decoded = NULL;
+    pt->queue_depth = NULL;
     pt->width = 50;
+    pt->silent = progress_quiet;
     pt->last_display_time = 0.0;
     pthread_mutex_init(&pt->progress_mutex, NULL);
 }
 
-static void progress_update(ProgressTracker* pt, int frames_inc, int audio_inc) {
-    pthread_mutex_lock(&pt->progress_mutex);
-
-    pt->frames_processed += frames_inc;
-    pt->audio_packets += audio_inc;
+static void json_write_string(FILE* fp, const char* str) {
+    fputc('"', fp);
+    for (const unsigned char* c = (const unsigned char*)str; *c; c++) {
+        if (*c == '"' || *c == '\\') fprintf(fp, "\\%c", *c);
+        else if (*c < 0x20) fprintf(fp, "\\u%04x", *c);
+        else fputc(*c, fp);
+    }
+    fputc('"', fp);
+}
 
-    if (pt->frames_processed > pt->total_frames) {
-        pt->frames_processed = pt->total_frames;
+static void progress_json_line(ProgressTracker* pt, const char* event, int frames, double elapsed,
+                               double fps, double eta) {
+    pthread_mutex_lock(&progress_json_mutex);
+    fprintf(progress_json,
+            "{\"event\":\"%s\",\"t\":%.3f,\"frames\":%d,\"total\":%d,\"bytes\":%lld,"
+            "\"fps\":%.2f,\"eta\":%.2f,\"audio_packets\":%d",
+            event, elapsed, frames, pt->total_frames,
+            (long long)__atomic_load_n(&pt->bytes_written, __ATOMIC_RELAXED), fps, eta,
+            __atomic_load_n(&pt->audio_packets, __ATOMIC_RELAXED));
+    if (pt->decoded) {
+        fprintf(progress_json, ",\"decoded\":%d", __atomic_load_n(pt->decoded, __ATOMIC_RELAXED));
     }
+    if (pt->queue_depth) {
+        fprintf(progress_json, ",\"queued\":%d", __atomic_load_n(pt->queue_depth, __ATOMIC_RELAXED));
+    }
+    fputs("}\n", progress_json);
+    fflush(progress_json);
+    pthread_mutex_unlock(&progress_json_mutex);
+}
 
-    double elapsed = timer_elapsed(pt->start_time);
+// Per-file completion event. frame is the number the file is named by, -1
+// for an animation.
+static void progress_file_done(ProgressTracker* pt, int frame, const char* path) {
+    if (!progress_json) return;
+    struct stat st;
+    long long bytes = stat(path, &st) == 0 ? (long long)st.st_size : 0;
+    __atomic_fetch_add(&pt->bytes_written, bytes, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&progress_json_mutex);
+    fprintf(progress_json, "{\"event\":\"file\",\"t\":%.3f,\"frame\":%d,\"path\":",
+            timer_elapsed(pt->start_time), frame);
+    json_write_string(progress_json, path);
+    fprintf(progress_json, ",\"bytes\":%lld}\n", bytes);
+    fflush(progress_json);
+    pthread_mutex_unlock(&progress_json_mutex);
+}
 
-    if ((elapsed - pt->last_display_time) < 0.1 && 
-        pt->frames_processed < pt->total_frames) {
+static void progress_update(ProgressTracker* pt, int frames_inc, int audio_inc) {
+    int frames = __atomic_add_fetch(&pt->frames_processed, frames_inc, __ATOMIC_RELAXED);
+    if (audio_inc) __atomic_fetch_add(&pt->audio_packets, audio_inc, __ATOMIC_RELAXED);
+    if (frames > pt->total_frames) frames = pt->total_frames;
+    if (pt->silent && !progress_json) return;
+
+    // Cheap check first; the last frame always draws
+    double elapsed = timer_elapsed(pt->start_time);
+    const int last = frames >= pt->total_frames;
+    double drawn_at;
+    __atomic_load(&pt->last_display_time, &drawn_at, __ATOMIC_RELAXED);
+    if (!last && elapsed - drawn_at < 0.1) return;
+    if (last) pthread_mutex_lock(&pt->progress_mutex);
+    else if (pthread_mutex_trylock(&pt->progress_mutex) != 0) return;
+
+    if (!last && elapsed - pt->last_display_time < 0.1) {
         pthread_mutex_unlock(&pt->progress_mutex);
         return;
     }
-    pt->last_display_time = elapsed;
+    __atomic_store(&pt->last_display_time, &elapsed, __ATOMIC_RELAXED);
 
     float percentage = (pt->total_frames > 0) ? 
-                       (float)pt->frames_processed / pt->total_frames : 0;
+                       (float)frames / pt->total_frames : 0;
     if (percentage > 1.0f) percentage = 1.0f;
 
-    double frames_per_sec = (elapsed > 0.001) ? pt->frames_processed / elapsed : 0;
+    double frames_per_sec = (elapsed > 0.001) ? frames / elapsed : 0;
     double remaining_time = 0;
     if (percentage > 0.01 && frames_per_sec > 0) {
-        remaining_time = (pt->total_frames - pt->frames_processed) / frames_per_sec;
+        remaining_time = (pt->total_frames - frames) / frames_per_sec;
+    }
+
+    if (progress_json) {
+        progress_json_line(pt, "progress", frames, elapsed, frames_per_sec, remaining_time);
+    }
+    if (pt->silent) {
+        pthread_mutex_unlock(&pt->progress_mutex);
+        return;
     }
 
     printf("\r[");
@@ -126,10 +541,11 @@ static void progress_update(ProgressTracker* pt, int frames_inc, int audio_inc)
     printf("] %5.1f%%", percentage * 100);
 
     if (pt->total_frames > 0) {
-        printf(" | Frames: %d/%d", pt->frames_processed, pt->total_frames);
+        printf(" | Frames: %d/%d", frames, pt->total_frames);
     }
-    if (pt->audio_packets > 0) {
-        printf(" | Audio: %d packets", pt->audio_packets);
+    int audio_packets = __atomic_load_n(&pt->audio_packets, __ATOMIC_RELAXED);
+    if (audio_packets > 0) {
+        printf(" | Audio: %d packets", audio_packets);
     }
 
     if (frames_per_sec > 1000) {
@@ -153,9 +569,16 @@ static void progress_update(ProgressTracker* pt, int frames_inc, int audio_inc)
 }
 
 static void progress_finish(ProgressTracker* pt) {
-    progress_update(pt, pt->total_frames - pt->frames_processed, 0);
+    int processed = __atomic_load_n(&pt->frames_processed, __ATOMIC_RELAXED);
+    if (processed < pt->total_frames) {
+        progress_update(pt, pt->total_frames - processed, 0);
+    }
 
     double elapsed = timer_elapsed(pt->start_time);
+    if (progress_json) {
+        progress_json_line(pt, "done", pt->total_frames, elapsed,
+                           elapsed > 0.001 ? pt->total_frames / elapsed : 0, 0);
+    }
 
     printf("\n\n✅ Completed in %.2f seconds", elapsed);
     if (pt->total_frames > 0) {
@@ -168,19 +591,344 @@ static void progress_finish(ProgressTracker* pt) {
     pthread_mutex_destroy(&pt->progress_mutex);
 }
 
+// ==================== INPUT FINGERPRINT ====================
+
+// Identifies an input by content rather than path+mtime, so copies and
+// renames keep their cache entries: the file size, the container header,
+// the tail (MP4 moov, MKV cues) and evenly spaced blocks in between. A
+// fixed amount is read whatever the file size, on a few threads.
+
+#define FINGERPRINT_BLOCK (64 * 1024)
+#define FINGERPRINT_SAMPLES 16
+#define FINGERPRINT_THREADS 4
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+static uint64_t fnv1a64(const void* data, size_t len, uint64_t h) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+#define FNV64_BASIS 0xcbf29ce484222325ULL
+
+// xxh3 when available (-DHAVE_XXHASH), FNV-1a otherwise. The two give
+// different keys, so a cache directory belongs to one kind of build.
+static uint64_t block_hash(const void* data, size_t len, uint64_t seed) {
+#ifdef HAVE_XXHASH
+    return XXH3_64bits_withSeed(data, len, seed);
+#else
+    return fnv1a64(data, len, FNV64_BASIS ^ seed);
+#endif
+}
+
+static int64_t read_at(int fd, uint8_t* buf, size_t len, int64_t offset) {
+#ifdef _WIN32
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) return -1;
+    return _read(fd, buf, (unsigned)len);
+#else
+    return pread(fd, buf, len, (off_t)offset);
+#endif
+}
+
+// Size of a file, or -1. MSVCRT's plain stat has a 32-bit st_size.
+static int64_t file_size64(const char* path) {
+#ifdef _WIN32
+    struct _stati64 st;
+    if (_stati64(path, &st) != 0) return -1;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+#endif
+    return (int64_t)st.st_size;
+}
+
+typedef struct {
+    const char* path;
+    const int64_t* offsets;
+    int count;
+    int first;                // this worker hashes blocks first, first + THREADS, ...
+    uint64_t* hashes;
+    int ok;
+} FingerprintJob;
+
+// Each worker has its own descriptor: pread needs none of the shared
+// seek position, and Windows has no pread at all.
+static void* fingerprint_thread(void* arg) {
+    FingerprintJob* job = (FingerprintJob*)arg;
+    uint8_t* buf = (uint8_t*)malloc(FINGERPRINT_BLOCK);
+    int fd = open(job->path, O_RDONLY | O_BINARY);
+    job->ok = buf && fd >= 0;
+    for (int i = job->first; job->ok && i < job->count; i += FINGERPRINT_THREADS) {
+        int64_t n = read_at(fd, buf, FINGERPRINT_BLOCK, job->offsets[i]);
+        if (n < 0) job->ok = 0;
+        else job->hashes[i] = block_hash(buf, (size_t)n, (uint64_t)job->offsets[i]);
+    }
+    if (fd >= 0) close(fd);
+    free(buf);
+    return NULL;
+}
+
+int input_fingerprint(const char* path, uint64_t* key) {
+    int64_t size = file_size64(path);
+    if (size < 0) return 0;
+
+    // Small files are hashed whole; larger ones at fixed relative offsets,
+    // 4 KiB aligned, always including the first and last block.
+    int64_t offsets[FINGERPRINT_SAMPLES];
+    int count = 0;
+    if (size <= (int64_t)FINGERPRINT_BLOCK * FINGERPRINT_SAMPLES) {
+        for (int64_t off = 0; off < size || count == 0; off += FINGERPRINT_BLOCK) offsets[count++] = off;
+    } else {
+        int64_t last = size - FINGERPRINT_BLOCK;
+        for (int i = 0; i < FINGERPRINT_SAMPLES; i++) {
+            offsets[count++] = i == FINGERPRINT_SAMPLES - 1 ? last
+                : (last / (FINGERPRINT_SAMPLES - 1) * i) & ~(int64_t)4095;
+        }
+    }
+
+    uint64_t hashes[FINGERPRINT_SAMPLES + 1];
+    hashes[FINGERPRINT_SAMPLES] = (uint64_t)size;
+    pthread_t tids[FINGERPRINT_THREADS];
+    int started[FINGERPRINT_THREADS];
+    FingerprintJob jobs[FINGERPRINT_THREADS];
+    int threads = FFMIN(FINGERPRINT_THREADS, count);
+    for (int t = 0; t < threads; t++) {
+        jobs[t] = (FingerprintJob){path, offsets, count, t, hashes, 0};
+        started[t] = pthread_create(&tids[t], NULL, fingerprint_thread, &jobs[t]) == 0;
+        if (!started[t]) fingerprint_thread(&jobs[t]);
+    }
+    int ok = 1;
+    for (int t = 0; t < threads; t++) {
+        if (started[t]) pthread_join(tids[t], NULL);
+        ok = ok && jobs[t].ok;
+    }
+    if (!ok) return 0;
+
+    for (int i = count; i < FINGERPRINT_SAMPLES; i++) hashes[i] = 0;
+    *key = block_hash(hashes, sizeof(hashes), 0);
+    return 1;
+}
+
+// ==================== FRAME CACHE ====================
+
+// -frame-cache: encoded outputs kept across runs, keyed by the input's
+// fingerprint, the frame PTS and the settings that change the output bytes.
+// Entries are plain files <input>-<spec>-<pts>.<ext>; the mtime is the
+// LRU clock, bumped on every hit.
+
+typedef struct {
+    char dir[512];
+    uint64_t input_key;       // fingerprint of the input file
+    uint64_t spec_key;        // hash of the output settings
+    int64_t limit_bytes;
+    pthread_t evictor;
+    int evicting;
+    int hits;
+    int stores;
+} FrameCache;
+
+static int copy_file(const char* src, const char* dst) {
+    FILE* in = fopen(src, "rb");
+    if (!in) return 0;
+    FILE* out = fopen(dst, "wb");
+    if (!out) { fclose(in); return 0; }
+    char buf[64 * 1024];
+    size_t n;
+    int ok = 1;
+    while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        ok = fwrite(buf, 1, n, out) == n;
+    }
+    ok = !ferror(in) && ok;
+    fclose(in);
+    if (fclose(out) != 0) ok = 0;
+    return ok;
+}
+
+static const char* file_extension(const char* path) {
+    const char* dot = strrchr(path, '.');
+    const char* sep = strrchr(path, '/');
+    return dot && (!sep || dot > sep) ? dot : "";
+}
+
+static void frame_cache_path(const FrameCache* cache, int64_t pts, const char* ext,
+                             char* out, size_t size) {
+    snprintf(out, size, "%s/%016llx-%016llx-%lld%s", cache->dir,
+             (unsigned long long)cache->input_key, (unsigned long long)cache->spec_key,
+             (long long)pts, ext);
+}
+
+// Copies the cached output for pts to dst. Returns 1 on a hit.
+int frame_cache_fetch(FrameCache* cache, int64_t pts, const char* dst) {
+    char path[768];
+    frame_cache_path(cache, pts, file_extension(dst), path, sizeof(path));
+    if (!copy_file(path, dst)) {
+        remove(dst);
+        return 0;
+    }
+    utime(path, NULL);
+    cache->hits++;
+    return 1;
+}
+
+// Called by the savers with a finished output file. Written under a
+// temporary name and renamed, so other runs never see a partial entry.
+void frame_cache_store(FrameCache* cache, int64_t pts, const char* src) {
+    char path[768], tmp[800];
+    frame_cache_path(cache, pts, file_extension(src), path, sizeof(path));
+    if (access(path, F_OK) == 0) return;
+    snprintf(tmp, sizeof(tmp), "%s.%d.%lu.tmp", path, (int)getpid(),
+             (unsigned long)(uintptr_t)pthread_self());
+    if (copy_file(src, tmp) && rename(tmp, path) == 0) {
+        __atomic_fetch_add(&cache->stores, 1, __ATOMIC_RELAXED);
+    } else {
+        remove(tmp);
+    }
+}
+
+// Whether a directory entry is a finished cache entry, i.e. exactly what
+// frame_cache_path produces: 16 hex digits, '-', 16 hex digits, '-', the
+// PTS, then one alphanumeric extension. Anything else in the directory
+// (the user's own files, temporaries still being written) is not ours.
+static int frame_cache_entry_name(const char* name) {
+    const char* p = name;
+    for (int part = 0; part < 2; part++) {
+        for (int i = 0; i < 16; i++, p++) {
+            if (!isxdigit((unsigned char)*p)) return 0;
+        }
+        if (*p++ != '-') return 0;
+    }
+    if (*p == '-') p++;
+    if (!isdigit((unsigned char)*p)) return 0;
+    while (isdigit((unsigned char)*p)) p++;
+    if (*p++ != '.' || !isalnum((unsigned char)*p)) return 0;
+    while (isalnum((unsigned char)*p)) p++;
+    return *p == '\0';
+}
+
+typedef struct {
+    char name[288];
+    int64_t size;
+    time_t mtime;
+} CacheEntry;
+
+static int compare_cache_age(const void* a, const void* b) {
+    time_t x = ((const CacheEntry*)a)->mtime, y = ((const CacheEntry*)b)->mtime;
+    return (x > y) - (x < y);
+}
+
+// Trims the cache entries to 90% of the limit, least recently used first;
+// other files in the directory are neither counted nor touched. Runs next to the extraction so it never delays the first frame.
+static void* frame_cache_evict_thread(void* arg) {
+    FrameCache* cache = (FrameCache*)arg;
+    DIR* dir = opendir(cache->dir);
+    if (!dir) return NULL;
+
+    CacheEntry* entries = NULL;
+    int count = 0, capacity = 0;
+    int64_t total = 0;
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL) {
+        if (!frame_cache_entry_name(de->d_name) || strlen(de->d_name) >= sizeof(entries->name)) continue;
+        char path[1024];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, de->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            CacheEntry* grown = (CacheEntry*)realloc(entries, capacity * sizeof(CacheEntry));
+            if (!grown) break;
+            entries = grown;
+        }
+        strcpy(entries[count].name, de->d_name);
+        entries[count].size = (int64_t)st.st_size;
+        entries[count].mtime = st.st_mtime;
+        total += entries[count].size;
+        count++;
+    }
+    closedir(dir);
+
+    if (total > cache->limit_bytes) {
+        qsort(entries, count, sizeof(CacheEntry), compare_cache_age);
+        int64_t target = cache->limit_bytes / 10 * 9;
+        for (int i = 0; i < count && total > target; i++) {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s", cache->dir, entries[i].name);
+            if (remove(path) == 0) total -= entries[i].size;
+        }
+    }
+    free(entries);
+    return NULL;
+}
+
+int frame_cache_open(FrameCache* cache, const char* dir, double limit_gb, const char* input,
+                     const char* spec) {
+    memset(cache, 0, sizeof(FrameCache));
+    snprintf(cache->dir, sizeof(cache->dir), "%s", dir);
+    MKDIR(cache->dir);
+    if (!input_fingerprint(input, &cache->input_key)) return 0;
+    cache->spec_key = fnv1a64(spec, strlen(spec), FNV64_BASIS);
+    cache->limit_bytes = (int64_t)(limit_gb * 1024.0 * 1024.0 * 1024.0);
+    cache->evicting = pthread_create(&cache->evictor, NULL, frame_cache_evict_thread, cache) == 0;
+    return 1;
+}
+
+void frame_cache_close(FrameCache* cache) {
+    if (cache->evicting) pthread_join(cache->evictor, NULL);
+    cache->evicting = 0;
+}
+
 // ==================== MULTI-THREADING STRUCTURES ====================
 
 #define MAX_QUEUE_SIZE 32
 #define NUM_SAVER_THREADS 4
 
+static int cpu_count() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
 typedef struct {
     AVFrame* frames[MAX_QUEUE_SIZE];
     int frame_numbers[MAX_QUEUE_SIZE];
+    double push_times[MAX_QUEUE_SIZE];
     int width;
     int height;
     int format;
     int fast_mode;
+    int png_level;
+    int depth;             // 8 or 16 bits per sample
+    int tonemap;           // TONEMAP_* for PQ/HLG sources
+    int rotation;          // clockwise display rotation: 0, 90, 180, 270
+    int correct_sar;       // stretch non-square pixels to display aspect
+    int deinterlace;       // DEINTERLACE_FAST runs in the savers
+    int pyramid;           // >1: also write 1/2, 1/4, ... levels
+    int tile_w, tile_h;    // >0: write tiles instead of the whole frame
+    int tile_overlap;      // pixels shared by neighbouring tiles
+    int tile_batch;        // one NHWC .npy per frame instead of PNGs
+    double tile_min_variance;  // skip tiles flatter than this (0 = keep all)
+    int fit_w, fit_h;      // >0: fit every frame to this size
+    int fit_mode;          // FIT_*
+    uint8_t pad_color[3];  // letterbox bars
+    int quality;           // WebP quality 0-100
+    int webp_method;       // WebP effort 0 (fast) - 6 (small)
+    int lossless;          // WebP lossless
+    int png_threads;       // deflate threads per PNG, 0 = auto
     char output_pattern[512];
+    AVRational time_base;  // of the queued frames' PTS, for %t/%p names
+    int64_t pts_origin;    // PTS that %t counts from
+    FrameCache* cache;     // -frame-cache, NULL when off
 
     int head;
     int tail;
@@ -193,6 +941,12 @@ typedef struct {
     int done;
     int frames_saved;
     int total_frames;
+
+    // Per-frame latency (decoded -> saved), only recorded when latencies
+    // is allocated by the caller with room for total_frames entries.
+    Timer clock;
+    double* latencies;
+    int latency_count;
 } FrameQueue;
 
 typedef struct {
@@ -203,7 +957,12 @@ typedef struct {
 
 // ==================== PNG SAVING ====================
 
-int save_png(const char* filename, uint8_t* image, int width, int height) {
+// image: packed RGB, 8 or 16 bits per sample (16-bit samples big-endian,
+// as PNG stores them), rows stride bytes apart so a sub-rectangle of a
+// larger buffer can be written in place. level: zlib level 0-9, or -1 for
+// the libpng default.
+int save_png_rect(const char* filename, const uint8_t* image, int width, int height, size_t stride,
+                  int bit_depth, int level) {
     FILE *fp = fopen(filename, "wb"); 
     if (!fp) return 0;
 
@@ -220,14 +979,17 @@ int save_png(const char* filename, uint8_t* image, int width, int height) {
     }
 
     png_init_io(png, fp);
-    png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB, 
+    if (level >= 0) {
+        png_set_compression_level(png, level);
+    }
+    png_set_IHDR(png, info, width, height, bit_depth, PNG_COLOR_TYPE_RGB, 
                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, 
                  PNG_FILTER_TYPE_DEFAULT);
     png_write_info(png, info);
 
     png_bytep rows[height];
     for (int y = 0; y < height; y++) {
-        rows[y] = image + y * width * 3;
+        rows[y] = (png_bytep)(image + y * stride);
     }
 
     png_write_image(png, rows);
@@ -237,80 +999,718 @@ int save_png(const char* filename, uint8_t* image, int width, int height) {
     return 1;
 }
 
-// ==================== RAW YUV SAVING ====================
-
-void save_yuv_frame(AVFrame* frame, const char* filename, int width, int height) {
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) return;
+int save_png(const char* filename, uint8_t* image, int width, int height, int bit_depth, int level) {
+    return save_png_rect(filename, image, width, height, (size_t)width * 3 * (bit_depth / 8),
+                         bit_depth, level);
+}
 
-    for (int y = 0; y < height; y++) {
-        fwrite(frame->data[0] + y * frame->linesize[0], 1, width, fp);
+// ---- Parallel deflate for very large images ----
+// The filtered image is split into row ranges compressed on separate
+// threads, pigz style: each range is a raw deflate stream primed with the
+// 32 KB of filtered data before it and ended with a sync flush (the last
+// with Z_FINISH), so the concatenation is one valid zlib stream.
+
+#define PNG_DICT_SIZE 32768
+#define PNG_PARALLEL_MIN_PIXELS (1024 * 1024)
+
+// Sum of absolute signed residuals, libpng's filter selection metric.
+static long png_residual_sum(const uint8_t* v, int len) {
+    long sum = 0;
+    for (int i = 0; i < len; i++) {
+        int r = (int8_t)v[i];
+        sum += r < 0 ? -r : r;
     }
+    return sum;
+}
 
-    for (int y = 0; y < height/2; y++) {
-        fwrite(frame->data[1] + y * frame->linesize[1], 1, width/2, fp);
+// Writes the filter byte and filtered row to out, picking the filter with
+// the smallest residual sum. Each filter is a separate branch-free loop so
+// the compiler vectorizes it (Paeth uses the |b-c|, |a-c|, |a+b-2c|
+// form). scratch holds 4 * len bytes.
+static void png_filter_row(const uint8_t* row, const uint8_t* prev, int len, int bpp,
+                           uint8_t* out, uint8_t* scratch) {
+    uint8_t* cand[5] = {(uint8_t*)row, scratch, scratch + len, scratch + 2 * len, scratch + 3 * len};
+    int types = prev ? 5 : 2;   // on the first row Up/Avg/Paeth add nothing
+
+    for (int i = 0; i < bpp && i < len; i++) cand[1][i] = row[i];
+    for (int i = bpp; i < len; i++) cand[1][i] = (uint8_t)(row[i] - row[i - bpp]);
+
+    if (prev) {
+        for (int i = 0; i < len; i++) cand[2][i] = (uint8_t)(row[i] - prev[i]);
+        for (int i = 0; i < bpp && i < len; i++) cand[3][i] = (uint8_t)(row[i] - (prev[i] >> 1));
+        for (int i = bpp; i < len; i++) {
+            cand[3][i] = (uint8_t)(row[i] - ((row[i - bpp] + prev[i]) >> 1));
+        }
+        for (int i = 0; i < bpp && i < len; i++) cand[4][i] = (uint8_t)(row[i] - prev[i]);
+        for (int i = bpp; i < len; i++) {
+            int a = row[i - bpp], b = prev[i], c = prev[i - bpp];
+            int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+            int pred = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+            cand[4][i] = (uint8_t)(row[i] - pred);
+        }
     }
 
-    for (int y = 0; y < height/2; y++) {
-        fwrite(frame->data[2] + y * frame->linesize[2], 1, width/2, fp);
+    int best = 0;
+    long best_sum = png_residual_sum(cand[0], len);
+    for (int t = 1; t < types; t++) {
+        long sum = png_residual_sum(cand[t], len);
+        if (sum < best_sum) {
+            best_sum = sum;
+            best = t;
+        }
     }
-
-    fclose(fp);
+    out[0] = (uint8_t)best;
+    memcpy(out + 1, cand[best], len);
 }
 
-// ==================== FRAME QUEUE MANAGEMENT ====================
+typedef struct {
+    const uint8_t* image;
+    size_t stride;
+    int row_bytes;
+    int bpp;
+    int y0, y1;             // rows compressed by this job
+    int level;
+    int last;
+    uint8_t* out;
+    size_t out_len;
+    uLong adler;
+    size_t raw_len;
+    int ok;
+} DeflateJob;
+
+static void* deflate_job_thread(void* arg) {
+    DeflateJob* job = (DeflateJob*)arg;
+    ALLOC_STAGE(ALLOC_STAGE_ENCODE);
+    const size_t filtered_row = (size_t)job->row_bytes + 1;
+
+    // Filtering is deterministic, so the rows before y0 are re-filtered
+    // here to get the dictionary instead of waiting on the previous job.
+    int dict_rows = job->y0 > 0 ? (int)FFMIN((size_t)job->y0, PNG_DICT_SIZE / filtered_row + 1) : 0;
+    int first = job->y0 - dict_rows;
+    size_t raw_total = (size_t)(job->y1 - first) * filtered_row;
+    uint8_t* raw = (uint8_t*)malloc(raw_total);
+    uint8_t* scratch = (uint8_t*)malloc((size_t)job->row_bytes * 4);
+    job->ok = 0;
+    if (!raw || !scratch) goto done;
+
+    for (int y = first; y < job->y1; y++) {
+        const uint8_t* row = job->image + (size_t)y * job->stride;
+        png_filter_row(row, y > 0 ? row - job->stride : NULL, job->row_bytes, job->bpp,
+                       raw + (size_t)(y - first) * filtered_row, scratch);
+    }
 
-void queue_init(FrameQueue* q, int width, int height, int format, int fast_mode, 
-                const char* pattern, int total_frames) {
-    memset(q, 0, sizeof(FrameQueue));
-    q->width = width;
-    q->height = height;
-    q->format = format;
-    q->fast_mode = fast_mode;
-    strcpy(q->output_pattern, pattern);
-    q->total_frames = total_frames;
+    const uint8_t* data = raw + (size_t)dict_rows * filtered_row;
+    job->raw_len = (size_t)(job->y1 - job->y0) * filtered_row;
+    job->adler = adler32(adler32(0L, Z_NULL, 0), data, (uInt)job->raw_len);
 
-    pthread_mutex_init(&q->mutex, NULL);
-    pthread_cond_init(&q->not_full, NULL);
-    pthread_cond_init(&q->not_empty, NULL);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, job->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) goto done;
+    if (dict_rows > 0) {
+        size_t dict_len = FFMIN((size_t)dict_rows * filtered_row, (size_t)PNG_DICT_SIZE);
+        deflateSetDictionary(&zs, data - dict_len, (uInt)dict_len);
+    }
+    size_t cap = deflateBound(&zs, job->raw_len) + 16;
+    job->out = (uint8_t*)malloc(cap);
+    if (job->out) {
+        zs.next_in = (Bytef*)data;
+        zs.avail_in = (uInt)job->raw_len;
+        zs.next_out = job->out;
+        zs.avail_out = (uInt)cap;
+        int ret = deflate(&zs, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+        job->out_len = cap - zs.avail_out;
+        job->ok = job->last ? ret == Z_STREAM_END : (ret == Z_OK && zs.avail_in == 0);
+    }
+    deflateEnd(&zs);
+
+done:
+    free(raw);
+    free(scratch);
+    return NULL;
 }
 
-void queue_destroy(FrameQueue* q) {
-    pthread_mutex_destroy(&q->mutex);
-    pthread_cond_destroy(&q->not_full);
-    pthread_cond_destroy(&q->not_empty);
+static int write_png_chunk(FILE* fp, const char* type, const uint8_t* data, size_t len) {
+    uint8_t head[8] = {(uint8_t)(len >> 24), (uint8_t)(len >> 16), (uint8_t)(len >> 8), (uint8_t)len,
+                       (uint8_t)type[0], (uint8_t)type[1], (uint8_t)type[2], (uint8_t)type[3]};
+    uLong crc = crc32(crc32(0L, Z_NULL, 0), head + 4, 4);
+    if (len) crc = crc32(crc, data, (uInt)len);
+    uint8_t tail[4] = {(uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc};
+    return fwrite(head, 1, 8, fp) == 8 && (len == 0 || fwrite(data, 1, len, fp) == len) &&
+           fwrite(tail, 1, 4, fp) == 4;
 }
 
-void queue_push(FrameQueue* q, AVFrame* frame, int frame_number) {
-    pthread_mutex_lock(&q->mutex);
+// Same output contract as save_png_rect(), with the deflate work spread
+// over up to `threads` threads.
+int save_png_parallel(const char* filename, const uint8_t* image, int width, int height, size_t stride,
+                      int bit_depth, int level, int threads) {
+    const int bpp = 3 * (bit_depth / 8);
+    const int row_bytes = width * bpp;
+    if (level < 0) level = Z_DEFAULT_COMPRESSION;
+
+    // At least ~256 KB of input per job, or the sync-flush overhead dominates
+    int max_jobs = (int)FFMAX(1, (size_t)row_bytes * height / (256 * 1024));
+    int jobs = FFMIN(FFMIN(threads, max_jobs), height);
+    if (jobs < 1) jobs = 1;
+
+    DeflateJob* job = (DeflateJob*)calloc(jobs, sizeof(DeflateJob));
+    pthread_t* tids = (pthread_t*)calloc(jobs, sizeof(pthread_t));
+    int* started = (int*)calloc(jobs, sizeof(int));
+    int ok = job && tids && started;
+
+    for (int j = 0; ok && j < jobs; j++) {
+        job[j].image = image;
+        job[j].stride = stride;
+        job[j].row_bytes = row_bytes;
+        job[j].bpp = bpp;
+        job[j].y0 = (int)((int64_t)height * j / jobs);
+        job[j].y1 = (int)((int64_t)height * (j + 1) / jobs);
+        job[j].level = level;
+        job[j].last = j == jobs - 1;
+        started[j] = j > 0 && pthread_create(&tids[j], NULL, deflate_job_thread, &job[j]) == 0;
+    }
+    if (ok) {
+        deflate_job_thread(&job[0]);   // this thread takes the first range
+        for (int j = 1; j < jobs; j++) {
+            if (started[j]) pthread_join(tids[j], NULL);
+            else deflate_job_thread(&job[j]);
+        }
+    }
 
-    while (q->count >= MAX_QUEUE_SIZE) {
-        pthread_cond_wait(&q->not_full, &q->mutex);
+    FILE* fp = NULL;
+    uint8_t* idat = NULL;
+    size_t idat_len = 2 + 4;
+    for (int j = 0; ok && j < jobs; j++) {
+        ok = job[j].ok;
+        idat_len += job[j].out_len;
+    }
+    if (ok) idat = (uint8_t*)malloc(idat_len);
+    if (idat) {
+        // zlib header (deflate, 32K window, default level) + ranges + Adler-32
+        size_t pos = 0;
+        idat[pos++] = 0x78;
+        idat[pos++] = 0x9C;
+        uLong adler = job[0].adler;
+        for (int j = 0; j < jobs; j++) {
+            memcpy(idat + pos, job[j].out, job[j].out_len);
+            pos += job[j].out_len;
+            if (j > 0) adler = adler32_combine(adler, job[j].adler, (z_off_t)job[j].raw_len);
+        }
+        idat[pos++] = (uint8_t)(adler >> 24);
+        idat[pos++] = (uint8_t)(adler >> 16);
+        idat[pos++] = (uint8_t)(adler >> 8);
+        idat[pos++] = (uint8_t)adler;
+
+        static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        uint8_t ihdr[13] = {(uint8_t)(width >> 24), (uint8_t)(width >> 16), (uint8_t)(width >> 8), (uint8_t)width,
+                            (uint8_t)(height >> 24), (uint8_t)(height >> 16), (uint8_t)(height >> 8), (uint8_t)height,
+                            (uint8_t)bit_depth, 2 /* RGB */, 0, 0, 0};
+        fp = fopen(filename, "wb");
+        ok = fp && fwrite(signature, 1, 8, fp) == 8 &&
+             write_png_chunk(fp, "IHDR", ihdr, sizeof(ihdr)) &&
+             write_png_chunk(fp, "IDAT", idat, pos) &&
+             write_png_chunk(fp, "IEND", NULL, 0);
+        if (fp) fclose(fp);
+    } else {
+        ok = 0;
     }
 
-    q->frames[q->head] = av_frame_clone(frame);
-    q->frame_numbers[q->head] = frame_number;
-    q->head = (q->head + 1) % MAX_QUEUE_SIZE;
-    q->count++;
+    for (int j = 0; job && j < jobs; j++) free(job[j].out);
+    free(idat);
+    free(job);
+    free(tids);
+    free(started);
+    return ok;
+}
 
-    pthread_cond_signal(&q->not_empty);
-    pthread_mutex_unlock(&q->mutex);
+#ifdef HAVE_LIBDEFLATE
+// ---- libdeflate encoder ----
+// Writes the PNG chunks directly: the whole filtered image is compressed
+// in one libdeflate call, which is several times faster than zlib at the
+// same level. One encoder per saver thread keeps the compressor and the
+// filter/output buffers for the whole run.
+
+typedef struct {
+    struct libdeflate_compressor* compressor;
+    uint8_t* filtered;
+    size_t filtered_cap;
+    uint8_t* out;
+    size_t out_cap;
+    uint8_t* scratch;
+    size_t scratch_cap;
+} PngEncoder;
+
+int png_encoder_init(PngEncoder* enc, int level) {
+    memset(enc, 0, sizeof(PngEncoder));
+    enc->compressor = libdeflate_alloc_compressor(level < 0 ? 6 : level);
+    return enc->compressor != NULL;
 }
 
-int queue_pop(FrameQueue* q, AVFrame** frame, int* frame_number) {
-    pthread_mutex_lock(&q->mutex);
+void png_encoder_free(PngEncoder* enc) {
+    if (enc->compressor) libdeflate_free_compressor(enc->compressor);
+    free(enc->filtered);
+    free(enc->out);
+    free(enc->scratch);
+    memset(enc, 0, sizeof(PngEncoder));
+}
 
-    while (q->count == 0 && !q->done) {
-        pthread_cond_wait(&q->not_empty, &q->mutex);
-    }
+static int grow_buffer(uint8_t** buf, size_t* cap, size_t need) {
+    if (*cap >= need) return 1;
+    uint8_t* p = (uint8_t*)realloc(*buf, need);
+    if (!p) return 0;
+    *buf = p;
+    *cap = need;
+    return 1;
+}
 
-    if (q->count == 0 && q->done) {
-        pthread_mutex_unlock(&q->mutex);
+// Same output contract as save_png_rect().
+int save_png_fast(PngEncoder* enc, const char* filename, const uint8_t* image, int width, int height,
+                  size_t stride, int bit_depth) {
+    const int bpp = 3 * (bit_depth / 8);
+    const int row_bytes = width * bpp;
+    const size_t filtered_len = (size_t)(row_bytes + 1) * height;
+    if (!grow_buffer(&enc->filtered, &enc->filtered_cap, filtered_len) ||
+        !grow_buffer(&enc->scratch, &enc->scratch_cap, (size_t)row_bytes * 4)) {
+        return 0;
+    }
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = image + (size_t)y * stride;
+        png_filter_row(row, y > 0 ? row - stride : NULL, row_bytes, bpp,
+                       enc->filtered + (size_t)y * (row_bytes + 1), enc->scratch);
+    }
+
+    size_t bound = libdeflate_zlib_compress_bound(enc->compressor, filtered_len);
+    if (!grow_buffer(&enc->out, &enc->out_cap, bound)) return 0;
+    size_t out_len = libdeflate_zlib_compress(enc->compressor, enc->filtered, filtered_len,
+                                              enc->out, enc->out_cap);
+    if (out_len == 0) return 0;
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    uint8_t ihdr[13] = {(uint8_t)(width >> 24), (uint8_t)(width >> 16), (uint8_t)(width >> 8), (uint8_t)width,
+                        (uint8_t)(height >> 24), (uint8_t)(height >> 16), (uint8_t)(height >> 8), (uint8_t)height,
+                        (uint8_t)bit_depth, 2 /* RGB */, 0, 0, 0};
+    FILE* fp = fopen(filename, "wb");
+    if (!fp) return 0;
+    int ok = fwrite(signature, 1, 8, fp) == 8 &&
+             write_png_chunk(fp, "IHDR", ihdr, sizeof(ihdr)) &&
+             write_png_chunk(fp, "IDAT", enc->out, out_len) &&
+             write_png_chunk(fp, "IEND", NULL, 0);
+    fclose(fp);
+    return ok;
+}
+#endif
+
+// ==================== RAW YUV SAVING ====================
+
+int save_yuv_frame(AVFrame* frame, const char* filename, int width, int height) {
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) return 0;
+
+    for (int y = 0; y < height; y++) {
+        fwrite(frame->data[0] + y * frame->linesize[0], 1, width, fp);
+    }
+
+    for (int y = 0; y < height/2; y++) {
+        fwrite(frame->data[1] + y * frame->linesize[1], 1, width/2, fp);
+    }
+
+    for (int y = 0; y < height/2; y++) {
+        fwrite(frame->data[2] + y * frame->linesize[2], 1, width/2, fp);
+    }
+
+    fclose(fp);
+    return 1;
+}
+
+// ==================== WEBP SAVING ====================
+
+enum { FORMAT_PNG = 0, FORMAT_WEBP };
+
+#ifdef HAVE_WEBP
+// One per saver thread: the config, picture and output buffer live for the
+// whole run instead of being set up per frame.
+typedef struct {
+    WebPConfig config;
+    WebPPicture pic;
+    WebPMemoryWriter writer;
+} WebpEncoder;
+
+int webp_encoder_init(WebpEncoder* enc, int quality, int method, int lossless) {
+    if (!WebPConfigPreset(&enc->config, WEBP_PRESET_PHOTO, (float)quality)) return 0;
+    enc->config.method = method;
+    enc->config.lossless = lossless;
+    enc->config.thread_level = 0;   // the savers already run one per core
+    if (!WebPValidateConfig(&enc->config) || !WebPPictureInit(&enc->pic)) return 0;
+    WebPMemoryWriterInit(&enc->writer);
+    return 1;
+}
+
+void webp_encoder_free(WebpEncoder* enc) {
+    WebPPictureFree(&enc->pic);
+    WebPMemoryWriterClear(&enc->writer);
+}
+
+static int webp_encode_to_file(WebpEncoder* enc, const char* filename) {
+    enc->writer.size = 0;   // keep the buffer, drop the previous image
+    enc->pic.writer = WebPMemoryWrite;
+    enc->pic.custom_ptr = &enc->writer;
+    if (!WebPEncode(&enc->config, &enc->pic)) return 0;
+
+    FILE* fp = fopen(filename, "wb");
+    if (!fp) return 0;
+    size_t written = fwrite(enc->writer.mem, 1, enc->writer.size, fp);
+    fclose(fp);
+    return written == enc->writer.size;
+}
+
+// rgb: packed RGB24.
+int save_webp_rgb(WebpEncoder* enc, const char* filename, const uint8_t* rgb, int width, int height) {
+    enc->pic.use_argb = enc->config.lossless;
+    enc->pic.width = width;
+    enc->pic.height = height;
+    if (!WebPPictureImportRGB(&enc->pic, rgb, width * 3)) return 0;
+    return webp_encode_to_file(enc, filename);
+}
+
+// Lossy WebP is limited-range BT.601 4:2:0, which is what most SD and
+// web video decodes to; such frames are encoded from the decoded planes
+// with no RGB round trip.
+int webp_can_import_yuv(const AVFrame* frame) {
+    return frame->format == AV_PIX_FMT_YUV420P &&
+           frame->color_range != AVCOL_RANGE_JPEG &&
+           (frame->colorspace == AVCOL_SPC_UNSPECIFIED || frame->colorspace == AVCOL_SPC_BT470BG ||
+            frame->colorspace == AVCOL_SPC_SMPTE170M);
+}
+
+int save_webp_yuv420(WebpEncoder* enc, const char* filename, const AVFrame* frame) {
+    WebPPictureFree(&enc->pic);   // drop buffers owned by an earlier RGB import
+    enc->pic.use_argb = 0;
+    enc->pic.colorspace = WEBP_YUV420;
+    enc->pic.width = frame->width;
+    enc->pic.height = frame->height;
+    enc->pic.y = frame->data[0];
+    enc->pic.u = frame->data[1];
+    enc->pic.v = frame->data[2];
+    enc->pic.y_stride = frame->linesize[0];
+    enc->pic.uv_stride = frame->linesize[1];
+    int ok = webp_encode_to_file(enc, filename);
+    enc->pic.y = enc->pic.u = enc->pic.v = NULL;   // borrowed from the frame
+    return ok;
+}
+#endif
+
+// ==================== HDR TONEMAPPING ====================
+
+enum { TONEMAP_NONE = 0, TONEMAP_HABLE, TONEMAP_REINHARD };
+
+#define HDR_PEAK_NITS 1000.0
+#define SDR_WHITE_NITS 203.0        // ITU-R BT.2408 reference white
+#define TONEMAP_LUT_SIZE 4096
+
+static float pq_eotf_lut[TONEMAP_LUT_SIZE + 2];   // PQ code -> linear, 1.0 = SDR white
+static float hlg_eotf_lut[TONEMAP_LUT_SIZE + 2];  // HLG code -> scene linear [0,1]
+static uint16_t srgb_oetf_lut[TONEMAP_LUT_SIZE + 2]; // sqrt(linear) -> 16-bit sRGB code
+static pthread_once_t tonemap_once = PTHREAD_ONCE_INIT;
+
+static void tonemap_init_tables() {
+    const double m1 = 2610.0 / 16384, m2 = 2523.0 / 4096 * 128;
+    const double c1 = 3424.0 / 4096, c2 = 2413.0 / 4096 * 32, c3 = 2392.0 / 4096 * 32;
+    const double a = 0.17883277, b = 0.28466892, c = 0.55991073;
+
+    for (int i = 0; i <= TONEMAP_LUT_SIZE + 1; i++) {
+        double e = FFMIN((double)i / TONEMAP_LUT_SIZE, 1.0);
+
+        // SMPTE ST 2084
+        double p = pow(e, 1.0 / m2);
+        double nits = 10000.0 * pow(FFMAX(p - c1, 0.0) / (c2 - c3 * p), 1.0 / m1);
+        pq_eotf_lut[i] = (float)(nits / SDR_WHITE_NITS);
+
+        // ARIB STD-B67 inverse OETF
+        hlg_eotf_lut[i] = (float)(e <= 0.5 ? e * e / 3.0 : (exp((e - c) / a) + b) / 12.0);
+
+        // Indexed by sqrt(linear) so the dark end gets most of the entries
+        double l = e * e;
+        double v = l <= 0.0031308 ? 12.92 * l : 1.055 * pow(l, 1.0 / 2.4) - 0.055;
+        srgb_oetf_lut[i] = (uint16_t)lrint(FFMIN(v, 1.0) * 65535.0);
+    }
+}
+
+static inline float lut_lerp(const float* lut, float v) {
+    v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+    float f = v * TONEMAP_LUT_SIZE;
+    int i = (int)f;
+    return lut[i] + (lut[i + 1] - lut[i]) * (f - i);
+}
+
+static inline float hable_curve(float x) {
+    const float A = 0.15f, B = 0.50f, C = 0.10f, D = 0.20f, E = 0.02f, F = 0.30f;
+    return (x * (A * x + C * B) + D * E) / (x * (A * x + B) + D * F) - E / F;
+}
+
+int frame_is_hdr(const AVFrame* frame) {
+    return frame->color_trc == AVCOL_TRC_SMPTE2084 || frame->color_trc == AVCOL_TRC_ARIB_STD_B67;
+}
+
+static inline int read_component(const AVFrame* f, const AVComponentDescriptor* c,
+                                 int x, int y, int wide) {
+    const uint8_t* p = f->data[c->plane] + (size_t)y * f->linesize[c->plane] + x * c->step + c->offset;
+    int v = wide ? (p[0] | (p[1] << 8)) : p[0];
+    return (v >> c->shift) & ((1 << c->depth) - 1);
+}
+
+// Fused YUV -> R'G'B' -> EOTF -> tonemap -> BT.709 primaries -> sRGB pass
+// for HDR frames. Each row is unpacked into float buffers that stay in L1
+// and the arithmetic loops are written so the compiler can vectorize them,
+// so the frame crosses memory once instead of once per stage.
+// Rows [y0, y1) are written starting at out; depth 8 writes RGB24, depth 16
+// big-endian RGB48. Only little-endian planar/semi-planar YUV is read (see
+// tonemap_supported()). Returns 0 on allocation failure.
+int tonemap_supported(const AVFrame* frame) {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+    return desc && desc->nb_components == 3 && desc->comp[0].depth >= 8 &&
+           !(desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_BE | AV_PIX_FMT_FLAG_PAL));
+}
+
+int tonemap_rows(const AVFrame* frame, int mode, int depth, int y0, int y1,
+                 uint8_t* out, int out_stride) {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+    pthread_once(&tonemap_once, tonemap_init_tables);
+
+    const int width = frame->width;
+    const int bits = desc->comp[0].depth;
+    const int wide = bits > 8;
+    const int full = frame->color_range == AVCOL_RANGE_JPEG;
+    const float scale = (float)(1 << (bits - 8));
+    const float y_off = full ? 0.0f : 16.0f * scale;
+    const float y_div = full ? (float)((1 << bits) - 1) : 219.0f * scale;
+    const float c_off = 128.0f * scale;
+    const float c_div = full ? (float)((1 << bits) - 1) : 224.0f * scale;
+
+    float kr = 0.2627f, kb = 0.0593f;                    // BT.2020 unless told otherwise
+    if (frame->colorspace == AVCOL_SPC_BT709) { kr = 0.2126f; kb = 0.0722f; }
+    else if (frame->colorspace == AVCOL_SPC_BT470BG ||
+             frame->colorspace == AVCOL_SPC_SMPTE170M) { kr = 0.299f; kb = 0.114f; }
+    const float kg = 1.0f - kr - kb;
+    const float cr_r = 2.0f * (1.0f - kr), cb_b = 2.0f * (1.0f - kb);
+    const int to_709 = frame->color_primaries != AVCOL_PRI_BT709;
+
+    const int pq = frame->color_trc == AVCOL_TRC_SMPTE2084;
+    const float peak = (float)(HDR_PEAK_NITS / SDR_WHITE_NITS);
+    const float hable_white = hable_curve(peak);
+    const float hlg_gain = (float)(HDR_PEAK_NITS / SDR_WHITE_NITS);
+
+    float* buf = (float*)malloc((size_t)width * 6 * sizeof(float));
+    if (!buf) return 0;
+    float *Y = buf, *U = buf + width, *V = buf + 2 * width;
+    float *R = buf + 3 * width, *G = buf + 4 * width, *B = buf + 5 * width;
+
+    for (int y = y0; y < y1; y++) {
+        int cy = y >> desc->log2_chroma_h;
+
+        for (int x = 0; x < width; x++) {
+            int cx = x >> desc->log2_chroma_w;
+            Y[x] = (read_component(frame, &desc->comp[0], x, y, wide) - y_off) / y_div;
+            U[x] = (read_component(frame, &desc->comp[1], cx, cy, wide) - c_off) / c_div;
+            V[x] = (read_component(frame, &desc->comp[2], cx, cy, wide) - c_off) / c_div;
+        }
+
+        // Non-linear R'G'B'
+        for (int x = 0; x < width; x++) {
+            R[x] = Y[x] + cr_r * V[x];
+            B[x] = Y[x] + cb_b * U[x];
+            G[x] = (Y[x] - kr * R[x] - kb * B[x]) / kg;
+        }
+
+        // Linear light, 1.0 = SDR reference white
+        const float* eotf = pq ? pq_eotf_lut : hlg_eotf_lut;
+        for (int x = 0; x < width; x++) {
+            R[x] = lut_lerp(eotf, R[x]);
+            G[x] = lut_lerp(eotf, G[x]);
+            B[x] = lut_lerp(eotf, B[x]);
+        }
+        if (!pq) {
+            // HLG OOTF, system gamma 1.2 at the nominal peak
+            for (int x = 0; x < width; x++) {
+                float ys = 0.2627f * R[x] + 0.6780f * G[x] + 0.0593f * B[x];
+                float gain = hlg_gain * powf(ys > 1e-6f ? ys : 1e-6f, 0.2f);
+                R[x] *= gain; G[x] *= gain; B[x] *= gain;
+            }
+        }
+
+        // Tonemap luminance and scale RGB by the same ratio to keep hue
+        for (int x = 0; x < width; x++) {
+            float l = 0.2627f * R[x] + 0.6780f * G[x] + 0.0593f * B[x];
+            float m = mode == TONEMAP_HABLE
+                ? hable_curve(l) / hable_white
+                : l * (1.0f + l / (peak * peak)) / (1.0f + l);
+            float ratio = l > 1e-6f ? m / l : 0.0f;
+            R[x] *= ratio; G[x] *= ratio; B[x] *= ratio;
+        }
+
+        if (to_709) {
+            for (int x = 0; x < width; x++) {
+                float r = R[x], g = G[x], b = B[x];
+                R[x] =  1.6605f * r - 0.5876f * g - 0.0728f * b;
+                G[x] = -0.1246f * r + 1.1329f * g - 0.0083f * b;
+                B[x] = -0.0182f * r - 0.1006f * g + 1.1187f * b;
+            }
+        }
+
+        uint8_t* dst = out + (size_t)(y - y0) * out_stride;
+        for (int x = 0; x < width; x++) {
+            float c3[3] = {R[x], G[x], B[x]};
+            for (int k = 0; k < 3; k++) {
+                float v = c3[k] < 0.0f ? 0.0f : (c3[k] > 1.0f ? 1.0f : c3[k]);
+                uint16_t code = srgb_oetf_lut[(int)(sqrtf(v) * TONEMAP_LUT_SIZE + 0.5f)];
+                if (depth == 16) {
+                    dst[x * 6 + k * 2] = (uint8_t)(code >> 8);
+                    dst[x * 6 + k * 2 + 1] = (uint8_t)code;
+                } else {
+                    dst[x * 3 + k] = (uint8_t)((code + 128) / 257);
+                }
+            }
+        }
+    }
+
+    free(buf);
+    return 1;
+}
+
+// ==================== DEINTERLACING ====================
+
+enum { DEINTERLACE_NONE, DEINTERLACE_FAST, DEINTERLACE_BWDIF };
+
+int frame_is_interlaced(const AVFrame* frame) {
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(58, 7, 100)
+    return (frame->flags & AV_FRAME_FLAG_INTERLACED) != 0;
+#else
+    return frame->interlaced_frame;
+#endif
+}
+
+static int frame_top_field_first(const AVFrame* frame) {
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(58, 7, 100)
+    return (frame->flags & AV_FRAME_FLAG_TOP_FIELD_FIRST) != 0;
+#else
+    return frame->top_field_first;
+#endif
+}
+
+// Linear line doubler: keeps the temporally first field and rebuilds the
+// other field's lines as the average of the lines above and below. The
+// row loops are plain averages so the compiler vectorizes them.
+static void line_double_plane(uint8_t* data, int linesize, int row_bytes, int rows,
+                              int keep_parity, int wide) {
+    if (rows < 2) return;
+    for (int y = !keep_parity; y < rows; y += 2) {
+        uint8_t* dst = data + (size_t)y * linesize;
+        const uint8_t* above = y > 0 ? dst - linesize : dst + linesize;
+        const uint8_t* below = y + 1 < rows ? dst + linesize : above;
+        if (wide) {
+            uint16_t* d = (uint16_t*)dst;
+            const uint16_t* a = (const uint16_t*)above;
+            const uint16_t* b = (const uint16_t*)below;
+            for (int x = 0; x < row_bytes / 2; x++) d[x] = (uint16_t)((a[x] + b[x] + 1) >> 1);
+        } else {
+            for (int x = 0; x < row_bytes; x++) dst[x] = (uint8_t)((above[x] + below[x] + 1) >> 1);
+        }
+    }
+}
+
+static void frame_mark_progressive(AVFrame* frame) {
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(58, 7, 100)
+    frame->flags &= ~AV_FRAME_FLAG_INTERLACED;
+#else
+    frame->interlaced_frame = 0;
+#endif
+}
+
+// Deinterlaces an interlaced frame in place for -deinterlace fast. This
+// copies decoder-owned buffers first, so the RGB paths read the field
+// directly instead (convert_field_rgb); this is for raw YUV output and the
+// layouts that can't. Progressive frames return untouched. Returns 0 if
+// the frame layout isn't planar/semi-planar or its buffers can't be made
+// writable.
+int deinterlace_fast(AVFrame* frame) {
+    if (!frame_is_interlaced(frame)) return 1;
+
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+    if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL))) {
+        return 0;
+    }
+    if (av_frame_make_writable(frame) < 0) return 0;
+
+    const int keep_parity = frame_top_field_first(frame) ? 0 : 1;
+    const int wide = desc->comp[0].depth > 8;
+    for (int p = 0; p < 4 && frame->data[p]; p++) {
+        int chroma = (p == 1 || p == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB);
+        int rows = chroma ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+        int row_bytes = av_image_get_linesize((enum AVPixelFormat)frame->format, frame->width, p);
+        if (row_bytes <= 0) continue;
+        line_double_plane(frame->data[p], frame->linesize[p], row_bytes, rows, keep_parity, wide);
+    }
+
+    frame_mark_progressive(frame);
+    return 1;
+}
+
+// ==================== FRAME QUEUE MANAGEMENT ====================
+
+void queue_init(FrameQueue* q, int width, int height, int format, int fast_mode, 
+                const char* pattern, int total_frames) {
+    memset(q, 0, sizeof(FrameQueue));
+    q->width = width;
+    q->height = height;
+    q->format = format;
+    q->fast_mode = fast_mode;
+    q->png_level = -1;
+    q->depth = 8;
+    strcpy(q->output_pattern, pattern);
+    q->total_frames = total_frames;
+
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+}
+
+void queue_destroy(FrameQueue* q) {
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+}
+
+void queue_push(FrameQueue* q, AVFrame* frame, int frame_number) {
+    pthread_mutex_lock(&q->mutex);
+
+    while (q->count >= MAX_QUEUE_SIZE) {
+        pthread_cond_wait(&q->not_full, &q->mutex);
+    }
+
+    q->frames[q->head] = av_frame_clone(frame);
+    q->frame_numbers[q->head] = frame_number;
+    q->push_times[q->head] = q->latencies ? timer_elapsed(q->clock) : 0.0;
+    q->head = (q->head + 1) % MAX_QUEUE_SIZE;
+    q->count++;
+
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+int queue_pop(FrameQueue* q, AVFrame** frame, int* frame_number, double* pushed_at) {
+    pthread_mutex_lock(&q->mutex);
+
+    while (q->count == 0 && !q->done) {
+        pthread_cond_wait(&q->not_empty, &q->mutex);
+    }
+
+    if (q->count == 0 && q->done) {
+        pthread_mutex_unlock(&q->mutex);
         return 0;
     }
 
     *frame = q->frames[q->tail];
     *frame_number = q->frame_numbers[q->tail];
+    if (pushed_at) *pushed_at = q->push_times[q->tail];
     q->tail = (q->tail + 1) % MAX_QUEUE_SIZE;
     q->count--;
 
@@ -326,404 +1726,4524 @@ void queue_set_done(FrameQueue* q) {
     pthread_mutex_unlock(&q->mutex);
 }
 
+// ==================== OUTPUT NAMING ====================
+
+// Presentation timestamp of a decoded or filtered frame.
+static int64_t frame_pts(const AVFrame* frame) {
+    return frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+}
+
+// Expands the output pattern for one frame. Besides the printf frame-number
+// conversion (frame_%04d.png), %t is the media time as HH-MM-SS.mmm (no
+// colons, so the name is valid on Windows) and %p the raw PTS.
+void format_output_name(char* out, size_t size, const char* pattern, int frame_number,
+                        int64_t pts, AVRational time_base, int64_t pts_origin) {
+    char expanded[1024];
+    size_t len = 0;
+    for (const char* p = pattern; *p && len + 32 < sizeof(expanded); p++) {
+        if (p[0] == '%' && p[1] == 't') {
+            int64_t ms = pts == AV_NOPTS_VALUE ? 0
+                : av_rescale_q(pts - pts_origin, time_base, (AVRational){1, 1000});
+            if (ms < 0) ms = 0;
+            len += snprintf(expanded + len, sizeof(expanded) - len, "%02lld-%02d-%02d.%03d",
+                            (long long)(ms / 3600000), (int)(ms / 60000 % 60),
+                            (int)(ms / 1000 % 60), (int)(ms % 1000));
+            p++;
+        } else if (p[0] == '%' && p[1] == 'p') {
+            len += snprintf(expanded + len, sizeof(expanded) - len, "%lld",
+                            (long long)(pts == AV_NOPTS_VALUE ? 0 : pts));
+            p++;
+        } else if (p[0] == '%' && p[1] == '%') {
+            expanded[len++] = *p++;
+            expanded[len++] = *p;
+        } else {
+            expanded[len++] = *p;
+        }
+    }
+    expanded[len] = '\0';
+    snprintf(out, size, expanded, frame_number);
+}
+
 // ==================== FRAME SAVER THREAD ====================
 
-void* frame_saver_thread(void* arg) {
-    SaverThreadArgs* args = (SaverThreadArgs*)arg;
-    FrameQueue* q = args->queue;
-    ProgressTracker* progress = args->progress;
+#define CONVERT_BAND_ROWS 16
 
-    AVFrame* frame;
-    int frame_number;
+// Display width after correcting a non-square sample aspect ratio.
+static int display_width(int width, AVRational sar) {
+    if (sar.num <= 0 || sar.den <= 0 || sar.num == sar.den) return width;
+    int w = (int)llround((double)width * sar.num / sar.den);
+    return FFMAX(2, w & ~1);
+}
 
-    while (queue_pop(q, &frame, &frame_number)) {
-        char filename[512];
-        snprintf(filename, sizeof(filename), q->output_pattern, frame_number);
+// Horizontal linear resample of one packed RGB row (samples are bytes, or
+// big-endian 16-bit pairs when bps == 2).
+static void resample_row(const uint8_t* src, int src_w, uint8_t* dst, int dst_w, int bps) {
+    const int px = 3 * bps;
+    const double step = (double)src_w / dst_w;
+    for (int x = 0; x < dst_w; x++) {
+        double fx = (x + 0.5) * step - 0.5;
+        int x0 = fx < 0 ? 0 : (int)fx;
+        int x1 = x0 + 1 < src_w ? x0 + 1 : src_w - 1;
+        int w1 = (int)((fx - x0) * 256.0 + 0.5);
+        if (w1 < 0) w1 = 0;
+        if (w1 > 256) w1 = 256;
+        const uint8_t* a = src + x0 * px;
+        const uint8_t* b = src + x1 * px;
+        uint8_t* d = dst + x * px;
+        for (int c = 0; c < 3; c++) {
+            if (bps == 2) {
+                int va = (a[2 * c] << 8) | a[2 * c + 1];
+                int vb = (b[2 * c] << 8) | b[2 * c + 1];
+                int v = (va * (256 - w1) + vb * w1 + 128) >> 8;
+                d[2 * c] = (uint8_t)(v >> 8);
+                d[2 * c + 1] = (uint8_t)v;
+            } else {
+                d[c] = (uint8_t)((a[c] * (256 - w1) + b[c] * w1 + 128) >> 8);
+            }
+        }
+    }
+}
 
-        if (q->fast_mode) {
-            if (strstr(filename, ".yuv") == NULL) {
-                char with_ext[512];
-                snprintf(with_ext, sizeof(with_ext), "%s.yuv", filename);
-                strcpy(filename, with_ext);
+// Writes a band of upright rows [y0, y0 + rows) into the rotated image.
+// Iterating source columns outermost keeps each destination write a short
+// contiguous run, so the band is transposed while still in cache.
+static void rotate_band(const uint8_t* band, int band_stride, int rows, int y0,
+                        int width, int height, int rotation, int px,
+                        uint8_t* out, int out_stride) {
+    if (rotation == 180) {
+        for (int r = 0; r < rows; r++) {
+            const uint8_t* src = band + (size_t)r * band_stride;
+            uint8_t* dst = out + (size_t)(height - 1 - (y0 + r)) * out_stride;
+            for (int x = 0; x < width; x++) {
+                memcpy(dst + (size_t)(width - 1 - x) * px, src + (size_t)x * px, px);
             }
-            save_yuv_frame(frame, filename, q->width, q->height);
+        }
+        return;
+    }
+
+    for (int x = 0; x < width; x++) {
+        // 90: (x, y) -> (height-1-y, x)   270: (x, y) -> (y, width-1-x)
+        uint8_t* dst_row = rotation == 90
+            ? out + (size_t)x * out_stride
+            : out + (size_t)(width - 1 - x) * out_stride;
+        for (int r = 0; r < rows; r++) {
+            int dx = rotation == 90 ? height - 1 - (y0 + r) : y0 + r;
+            memcpy(dst_row + (size_t)dx * px, band + (size_t)r * band_stride + (size_t)x * px, px);
+        }
+    }
+}
+
+// Plane row shift for the chroma planes of subsampled YUV layouts.
+static int plane_vshift(const AVPixFmtDescriptor* desc, int plane) {
+    if (desc->flags & AV_PIX_FMT_FLAG_RGB) return 0;
+    for (int c = 1; c < 3 && c < desc->nb_components; c++) {
+        if (desc->comp[c].plane == plane && plane != desc->comp[0].plane) {
+            return desc->log2_chroma_h;
+        }
+    }
+    return 0;
+}
+
+// Converts a decoded frame into the packed RGB buffer the encoders take:
+// RGB24 for -depth 8, big-endian RGB48 (PNG byte order) for -depth 16.
+// HDR frames go through the fused tonemap pass when -tonemap is set.
+// Rotation and SAR correction happen in the same pass: the frame is
+// converted in bands of CONVERT_BAND_ROWS rows which are resampled and
+// written rotated while they are still in cache.
+// Returns a malloc'd buffer (dimensions in out_w/out_h), or NULL.
+static uint8_t* convert_frame_oriented(FrameQueue* q, AVFrame* frame, int* out_w, int* out_h) {
+    // Frame dimensions, not the stream's: a -vf graph may resize
+    const int width = frame->width;
+    const int height = frame->height;
+    const int bps = q->depth == 16 ? 2 : 1;
+    const int px = 3 * bps;
+    const enum AVPixelFormat rgb_fmt = q->depth == 16 ? AV_PIX_FMT_RGB48BE : AV_PIX_FMT_RGB24;
+    const int tonemap = q->tonemap != TONEMAP_NONE && frame_is_hdr(frame) && tonemap_supported(frame);
+    const int dw = q->correct_sar ? display_width(width, frame->sample_aspect_ratio) : width;
+    const int rotation = q->rotation;
+
+    *out_w = (rotation == 90 || rotation == 270) ? height : dw;
+    *out_h = (rotation == 90 || rotation == 270) ? dw : height;
+    const int out_stride = *out_w * px;
+
+    uint8_t* rgb = (uint8_t*)malloc((size_t)out_stride * *out_h);
+    if (!rgb) return NULL;
+
+    // Upright and square pixels: convert straight into the output
+    if (rotation == 0 && dw == width) {
+        if (tonemap) {
+            if (tonemap_rows(frame, q->tonemap, q->depth, 0, height, rgb, out_stride)) return rgb;
+            free(rgb);
+            return NULL;
+        }
+
+        struct SwsContext* sws_ctx = sws_getContext(
+            width, height, frame->format,
+            width, height, rgb_fmt,
+            SWS_BILINEAR, NULL, NULL, NULL
+        );
+        if (!sws_ctx) {
+            free(rgb);
+            return NULL;
+        }
+
+        uint8_t* rgb_ptrs[1] = {rgb};
+        int rgb_linesize[1] = {out_stride};
+        sws_scale(sws_ctx, (const uint8_t* const*)frame->data, frame->linesize,
+                  0, height, rgb_ptrs, rgb_linesize);
+        sws_freeContext(sws_ctx);
+        return rgb;
+    }
+
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+    const int band_stride = width * px;
+    const int scaled_stride = dw * px;
+    uint8_t* band = (uint8_t*)malloc((size_t)band_stride * CONVERT_BAND_ROWS);
+    uint8_t* scaled = dw != width ? (uint8_t*)malloc((size_t)scaled_stride * CONVERT_BAND_ROWS) : NULL;
+    struct SwsContext* sws_ctx = NULL;
+    int ok = desc && band && (dw == width || scaled);
+
+    for (int y0 = 0; ok && y0 < height; y0 += CONVERT_BAND_ROWS) {
+        int rows = FFMIN(CONVERT_BAND_ROWS, height - y0);
+
+        if (tonemap) {
+            ok = tonemap_rows(frame, q->tonemap, q->depth, y0, y0 + rows, band, band_stride);
         } else {
-            if (strstr(filename, ".png") == NULL) {
-                char with_ext[512];
-                snprintf(with_ext, sizeof(with_ext), "%s.png", filename);
-                strcpy(filename, with_ext);
+            // Each band is converted as an image of its own; the band height
+            // is a multiple of every chroma subsampling factor, so the
+            // unscaled YUV->RGB path produces exactly the full-frame result.
+            sws_ctx = sws_getCachedContext(sws_ctx, width, rows, frame->format,
+                                           width, rows, rgb_fmt,
+                                           SWS_BILINEAR, NULL, NULL, NULL);
+            if (!sws_ctx) {
+                ok = 0;
+                break;
+            }
+            const uint8_t* src[4] = {NULL, NULL, NULL, NULL};
+            for (int p = 0; p < 4 && frame->data[p]; p++) {
+                src[p] = frame->data[p] + (size_t)(y0 >> plane_vshift(desc, p)) * frame->linesize[p];
+            }
+            uint8_t* dst[1] = {band};
+            int dst_linesize[1] = {band_stride};
+            sws_scale(sws_ctx, src, frame->linesize, 0, rows, dst, dst_linesize);
+        }
+
+        const uint8_t* upright = band;
+        int upright_stride = band_stride;
+        if (scaled) {
+            for (int r = 0; r < rows; r++) {
+                resample_row(band + (size_t)r * band_stride, width,
+                             scaled + (size_t)r * scaled_stride, dw, bps);
+            }
+            upright = scaled;
+            upright_stride = scaled_stride;
+        }
+
+        if (rotation == 0) {
+            for (int r = 0; r < rows; r++) {
+                memcpy(rgb + (size_t)(y0 + r) * out_stride, upright + (size_t)r * upright_stride,
+                       scaled_stride);
             }
+        } else {
+            rotate_band(upright, upright_stride, rows, y0, dw, height, rotation, px, rgb, out_stride);
+        }
+    }
+
+    sws_freeContext(sws_ctx);
+    free(band);
+    free(scaled);
+    if (!ok) {
+        free(rgb);
+        return NULL;
+    }
+    return rgb;
+}
+
+enum { FIT_LETTERBOX, FIT_CROP, FIT_STRETCH };
+
+// Scales an image into a fit_w x fit_h RGB buffer with one sws_scale.
+// disp_w/disp_h is the displayed size (after SAR), which sets the aspect.
+// letterbox: scale into an offset rectangle of a buffer prefilled with
+//            the pad colour;
+// crop:      scale a centred source window via offset plane pointers;
+// stretch:   scale the whole image to the target.
+static uint8_t* fit_image(FrameQueue* q, const uint8_t* const src_data[4], const int src_linesize[4],
+                          enum AVPixelFormat src_fmt, int src_w, int src_h, int disp_w, int disp_h) {
+    const int W = q->fit_w, H = q->fit_h;
+    const int bps = q->depth == 16 ? 2 : 1;
+    const int px = 3 * bps;
+    const size_t stride = (size_t)W * px;
+    const enum AVPixelFormat rgb_fmt = q->depth == 16 ? AV_PIX_FMT_RGB48BE : AV_PIX_FMT_RGB24;
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(src_fmt);
+    if (!desc) return NULL;
+
+    int cx = 0, cy = 0, cw = src_w, ch = src_h;   // source window
+    int ox = 0, oy = 0, sw = W, sh = H;           // destination rectangle
+
+    if (q->fit_mode == FIT_LETTERBOX) {
+        double scale = FFMIN((double)W / disp_w, (double)H / disp_h);
+        sw = FFMIN(W, FFMAX(1, (int)lround(disp_w * scale)));
+        sh = FFMIN(H, FFMAX(1, (int)lround(disp_h * scale)));
+        ox = (W - sw) / 2;
+        oy = (H - sh) / 2;
+    } else if (q->fit_mode == FIT_CROP) {
+        double scale = FFMAX((double)W / disp_w, (double)H / disp_h);
+        cw = FFMIN(src_w, FFMAX(1, (int)lround(W / scale * src_w / disp_w)));
+        ch = FFMIN(src_h, FFMAX(1, (int)lround(H / scale * src_h / disp_h)));
+        // Window origin on the chroma grid so every plane can be offset
+        cx = ((src_w - cw) / 2) & ~((1 << desc->log2_chroma_w) - 1);
+        cy = ((src_h - ch) / 2) & ~((1 << desc->log2_chroma_h) - 1);
+    }
+
+    uint8_t* rgb = (uint8_t*)malloc(stride * H);
+    if (!rgb) return NULL;
+
+    if (sw < W || sh < H) {
+        for (int x = 0; x < W; x++) {
+            for (int c = 0; c < 3; c++) {
+                for (int b = 0; b < bps; b++) rgb[x * px + c * bps + b] = q->pad_color[c];
+            }
+        }
+        for (int y = 1; y < H; y++) memcpy(rgb + y * stride, rgb, stride);
+    }
+
+    const uint8_t* src[4] = {NULL, NULL, NULL, NULL};
+    for (int p = 0; p < 4 && src_data[p]; p++) {
+        src[p] = src_data[p] + (size_t)(cy >> plane_vshift(desc, p)) * src_linesize[p];
+        if (cx > 0) src[p] += av_image_get_linesize(src_fmt, cx, p);
+    }
+
+    struct SwsContext* sws_ctx = sws_getContext(cw, ch, src_fmt, sw, sh, rgb_fmt,
+                                                SWS_BILINEAR, NULL, NULL, NULL);
+    if (!sws_ctx) {
+        free(rgb);
+        return NULL;
+    }
+    uint8_t* dst[1] = {rgb + (size_t)oy * stride + (size_t)ox * px};
+    int dst_linesize[1] = {(int)stride};
+    sws_scale(sws_ctx, src, src_linesize, 0, ch, dst, dst_linesize);
+    sws_freeContext(sws_ctx);
+    return rgb;
+}
+
+// convert_frame_oriented() plus -fit. Upright SDR frames are fitted
+// straight from the decoded planes; rotated or tonemapped frames are
+// fitted from the converted RGB image.
+static uint8_t* convert_frame_fitted(FrameQueue* q, AVFrame* frame, int* out_w, int* out_h) {
+    if (q->fit_w <= 0) return convert_frame_oriented(q, frame, out_w, out_h);
+
+    *out_w = q->fit_w;
+    *out_h = q->fit_h;
+    const int tonemap = q->tonemap != TONEMAP_NONE && frame_is_hdr(frame) && tonemap_supported(frame);
+    if (q->rotation == 0 && !tonemap) {
+        int dw = q->correct_sar ? display_width(frame->width, frame->sample_aspect_ratio) : frame->width;
+        return fit_image(q, (const uint8_t* const*)frame->data, frame->linesize,
+                         (enum AVPixelFormat)frame->format, frame->width, frame->height, dw, frame->height);
+    }
+
+    int w, h;
+    uint8_t* full = convert_frame_oriented(q, frame, &w, &h);
+    if (!full) return NULL;
+    const uint8_t* data[4] = {full, NULL, NULL, NULL};
+    int linesize[4] = {w * 3 * (q->depth == 16 ? 2 : 1), 0, 0, 0};
+    uint8_t* rgb = fit_image(q, data, linesize, q->depth == 16 ? AV_PIX_FMT_RGB48BE : AV_PIX_FMT_RGB24,
+                             w, h, w, h);
+    free(full);
+    return rgb;
+}
+
+// -deinterlace fast without writing to the decoder's buffers: the kept
+// field is read as a half-height image (every other line, doubled
+// linesize), and the sws_scale that converts it to RGB also scales it back
+// to full height, interpolating the dropped lines on the way. Rotated or
+// tonemapped frames line-double a private copy instead.
+static uint8_t* convert_field_rgb(FrameQueue* q, AVFrame* frame, int* out_w, int* out_h) {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+    const int tonemap = q->tonemap != TONEMAP_NONE && frame_is_hdr(frame) && tonemap_supported(frame);
+    const int direct = desc && !(desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM |
+                                                AV_PIX_FMT_FLAG_HWACCEL)) &&
+                       q->rotation == 0 && !tonemap && frame->height % 2 == 0;
+
+    if (direct) {
+        const int parity = frame_top_field_first(frame) ? 0 : 1;
+        const uint8_t* field[4] = {NULL, NULL, NULL, NULL};
+        int field_linesize[4] = {0, 0, 0, 0};
+        for (int p = 0; p < 4 && frame->data[p]; p++) {
+            field[p] = frame->data[p] + (size_t)parity * frame->linesize[p];
+            field_linesize[p] = frame->linesize[p] * 2;
+        }
+        const int rows = frame->height / 2;
+        const int dw = q->correct_sar ? display_width(frame->width, frame->sample_aspect_ratio) : frame->width;
+
+        if (q->fit_w > 0) {
+            *out_w = q->fit_w;
+            *out_h = q->fit_h;
+            return fit_image(q, field, field_linesize, (enum AVPixelFormat)frame->format,
+                             frame->width, rows, dw, frame->height);
+        }
+
+        const int px = 3 * (q->depth == 16 ? 2 : 1);
+        *out_w = dw;
+        *out_h = frame->height;
+        uint8_t* rgb = (uint8_t*)malloc((size_t)dw * px * frame->height);
+        struct SwsContext* sws_ctx = rgb ? sws_getContext(frame->width, rows, frame->format, dw, frame->height,
+                                                          q->depth == 16 ? AV_PIX_FMT_RGB48BE : AV_PIX_FMT_RGB24,
+                                                          SWS_BILINEAR, NULL, NULL, NULL)
+                                         : NULL;
+        if (!sws_ctx) {
+            free(rgb);
+            return NULL;
+        }
+        uint8_t* dst[1] = {rgb};
+        int dst_linesize[1] = {dw * px};
+        sws_scale(sws_ctx, field, field_linesize, 0, rows, dst, dst_linesize);
+        sws_freeContext(sws_ctx);
+        return rgb;
+    }
+
+    AVFrame* copy = av_frame_clone(frame);
+    if (!copy) return NULL;
+    if (!deinterlace_fast(copy)) frame_mark_progressive(copy);
+    uint8_t* rgb = convert_frame_fitted(q, copy, out_w, out_h);
+    av_frame_free(&copy);
+    return rgb;
+}
+
+// RGB for the savers: -deinterlace fast, orientation, SAR, tonemap and -fit
+// applied. The frame itself is never modified.
+static uint8_t* convert_frame_rgb(FrameQueue* q, AVFrame* frame, int* out_w, int* out_h) {
+    if (q->deinterlace == DEINTERLACE_FAST && frame_is_interlaced(frame)) {
+        return convert_field_rgb(q, frame, out_w, out_h);
+    }
+    return convert_frame_fitted(q, frame, out_w, out_h);
+}
+
+// Gives filename the extension ext, swapping a ".png" the pattern ended in.
+static void set_extension(char* filename, size_t size, const char* ext) {
+    size_t len = strlen(filename), ext_len = strlen(ext);
+    if (len >= ext_len && strcmp(filename + len - ext_len, ext) == 0) return;
+    if (len >= 4 && strcmp(filename + len - 4, ".png") == 0) filename[len - 4] = '\0';
+    strncat(filename, ext, size - strlen(filename) - 1);
+}
+
+#define MAX_PYRAMID_LEVELS 8
+
+// Halves a packed RGB image with a 2x2 box filter. Samples are bytes, or
+// big-endian 16-bit pairs when bps == 2. A trailing odd row/column is
+// dropped. The output is (w/2) x (h/2).
+static void downsample_2x2(const uint8_t* src, int w, int h, uint8_t* dst, int bps) {
+    const int ow = w / 2, oh = h / 2;
+    const size_t src_stride = (size_t)w * 3 * bps;
+    const size_t dst_stride = (size_t)ow * 3 * bps;
+    for (int y = 0; y < oh; y++) {
+        const uint8_t* r0 = src + (size_t)(2 * y) * src_stride;
+        const uint8_t* r1 = r0 + src_stride;
+        uint8_t* d = dst + (size_t)y * dst_stride;
+        if (bps == 2) {
+            for (int x = 0; x < ow * 3; x++) {
+                int c = x % 3, sx = (x - c) * 2 + c;   // sample index of the left pixel
+                int a = (r0[2 * sx] << 8) | r0[2 * sx + 1];
+                int b = (r0[2 * (sx + 3)] << 8) | r0[2 * (sx + 3) + 1];
+                int e = (r1[2 * sx] << 8) | r1[2 * sx + 1];
+                int f = (r1[2 * (sx + 3)] << 8) | r1[2 * (sx + 3) + 1];
+                int v = (a + b + e + f + 2) >> 2;
+                d[2 * x] = (uint8_t)(v >> 8);
+                d[2 * x + 1] = (uint8_t)v;
+            }
+        } else {
+            for (int x = 0; x < ow; x++) {
+                const uint8_t* p0 = r0 + x * 6;
+                const uint8_t* p1 = r1 + x * 6;
+                d[x * 3 + 0] = (uint8_t)((p0[0] + p0[3] + p1[0] + p1[3] + 2) >> 2);
+                d[x * 3 + 1] = (uint8_t)((p0[1] + p0[4] + p1[1] + p1[4] + 2) >> 2);
+                d[x * 3 + 2] = (uint8_t)((p0[2] + p0[5] + p1[2] + p1[5] + 2) >> 2);
+            }
+        }
+    }
+}
+
+typedef struct {
+    char filename[512];
+    uint8_t* rgb;
+    int width;
+    int height;
+    int depth;
+    int level;
+} PyramidLevel;
+
+static void* pyramid_encode_thread(void* arg) {
+    PyramidLevel* l = (PyramidLevel*)arg;
+    ALLOC_STAGE(ALLOC_STAGE_ENCODE);
+    save_png(l->filename, l->rgb, l->width, l->height, l->depth, l->level);
+    return NULL;
+}
+
+// Writes the full-size image to filename and each half-size level to
+// <name>_L<n>.png. Levels are built from the previous level, not from the
+// full frame, and encoded on their own threads while this thread encodes
+// level 0. Returns whether level 0 was written.
+static int save_pyramid(FrameQueue* q, const char* filename, uint8_t* rgb, int width, int height) {
+    const int bps = q->depth == 16 ? 2 : 1;
+    PyramidLevel levels[MAX_PYRAMID_LEVELS];
+    pthread_t threads[MAX_PYRAMID_LEVELS];
+    int started[MAX_PYRAMID_LEVELS] = {0};
+    int count = 1;
+
+    const char* ext = strrchr(filename, '.');
+    int stem = ext ? (int)(ext - filename) : (int)strlen(filename);
+
+    levels[0].rgb = rgb;
+    levels[0].width = width;
+    levels[0].height = height;
+    for (int l = 1; l < q->pyramid && l < MAX_PYRAMID_LEVELS; l++) {
+        PyramidLevel* prev = &levels[l - 1];
+        if (prev->width < 2 || prev->height < 2) break;
+        PyramidLevel* cur = &levels[l];
+        cur->width = prev->width / 2;
+        cur->height = prev->height / 2;
+        cur->depth = q->depth;
+        cur->level = q->png_level;
+        cur->rgb = (uint8_t*)malloc((size_t)cur->width * cur->height * 3 * bps);
+        if (!cur->rgb) break;
+        downsample_2x2(prev->rgb, prev->width, prev->height, cur->rgb, bps);
+        snprintf(cur->filename, sizeof(cur->filename), "%.*s_L%d.png", stem, filename, l);
+        started[l] = pthread_create(&threads[l], NULL, pyramid_encode_thread, cur) == 0;
+        if (!started[l]) pyramid_encode_thread(cur);
+        count++;
+    }
+
+    int ok = save_png(filename, rgb, width, height, q->depth, q->png_level);
+
+    for (int l = 1; l < count; l++) {
+        if (started[l]) pthread_join(threads[l], NULL);
+        free(levels[l].rgb);
+    }
+    return ok;
+}
+
+// Tile origins along one axis: every step pixels, plus one tile flush with
+// the far edge so the whole image is covered. Returns the count.
+static int tile_origins(int extent, int tile, int step, int* origins, int max) {
+    if (tile >= extent) {
+        origins[0] = 0;
+        return 1;
+    }
+    int n = 0;
+    int pos = 0;
+    for (; pos + tile <= extent && n < max; pos += step) origins[n++] = pos;
+    if (n < max && origins[n - 1] + tile < extent) origins[n++] = extent - tile;
+    return n;
+}
+
+// Sample variance over a tile (in 8-bit units), used to drop flat tiles.
+static double tile_variance(const uint8_t* tile, int w, int h, size_t stride, int bps) {
+    double sum = 0.0, sum_sq = 0.0;
+    const int samples = w * 3;
+    for (int y = 0; y < h; y++) {
+        const uint8_t* row = tile + (size_t)y * stride;
+        for (int i = 0; i < samples; i++) {
+            double v = row[i * bps];   // high byte for 16-bit big-endian
+            sum += v;
+            sum_sq += v * v;
+        }
+    }
+    double n = (double)samples * h;
+    double mean = sum / n;
+    return sum_sq / n - mean * mean;
+}
+
+// Writes a uint8 or big-endian uint16 NHWC array as a .npy file.
+static int write_npy_header(FILE* fp, int bps, int n, int h, int w) {
+    char header[128];
+    int len = snprintf(header, sizeof(header),
+                       "{'descr': '%s', 'fortran_order': False, 'shape': (%d, %d, %d, 3), }",
+                       bps == 2 ? ">u2" : "|u1", n, h, w);
+    int total = 10 + len + 1;
+    int pad = (64 - total % 64) % 64;
+    uint8_t preamble[10] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0,
+                            (uint8_t)((len + pad + 1) & 0xFF), (uint8_t)((len + pad + 1) >> 8)};
+    if (fwrite(preamble, 1, 10, fp) != 10 || fwrite(header, 1, len, fp) != (size_t)len) return 0;
+    for (int i = 0; i < pad; i++) fputc(' ', fp);
+    fputc('\n', fp);
+    return 1;
+}
+
+#define MAX_TILES_PER_AXIS 256
+
+// Cuts the converted frame into tile_w x tile_h tiles. Tiles are written
+// straight out of the frame buffer (PNGs via row pointers, the .npy batch
+// row by row), so nothing is copied per tile. Each file written is reported
+// to the progress stream under frame_number. Returns tiles written.
+static int save_tiles(FrameQueue* q, ProgressTracker* progress, int frame_number, const char* filename,
+                      const uint8_t* rgb, int width, int height) {
+    const int bps = q->depth == 16 ? 2 : 1;
+    const size_t stride = (size_t)width * 3 * bps;
+    const int tw = FFMIN(q->tile_w, width), th = FFMIN(q->tile_h, height);
+    const int step_x = FFMAX(1, tw - q->tile_overlap), step_y = FFMAX(1, th - q->tile_overlap);
+    int xs[MAX_TILES_PER_AXIS], ys[MAX_TILES_PER_AXIS];
+    int nx = tile_origins(width, tw, step_x, xs, MAX_TILES_PER_AXIS);
+    int ny = tile_origins(height, th, step_y, ys, MAX_TILES_PER_AXIS);
+
+    const char* ext = strrchr(filename, '.');
+    int stem = ext ? (int)(ext - filename) : (int)strlen(filename);
+
+    // Decide which tiles survive first: the .npy header needs the count
+    uint8_t keep[MAX_TILES_PER_AXIS * MAX_TILES_PER_AXIS / 8 + 1];
+    memset(keep, 0, sizeof(keep));
+    int kept = 0;
+    for (int r = 0; r < ny; r++) {
+        for (int c = 0; c < nx; c++) {
+            const uint8_t* tile = rgb + (size_t)ys[r] * stride + (size_t)xs[c] * 3 * bps;
+            if (q->tile_min_variance > 0 &&
+                tile_variance(tile, tw, th, stride, bps) < q->tile_min_variance) {
+                continue;
+            }
+            int k = r * nx + c;
+            keep[k / 8] |= (uint8_t)(1 << (k % 8));
+            kept++;
+        }
+    }
+
+    FILE* npy = NULL;
+    char npy_path[512];
+    if (q->tile_batch) {
+        snprintf(npy_path, sizeof(npy_path), "%.*s.npy", stem, filename);
+        npy = fopen(npy_path, "wb");
+        if (!npy || !write_npy_header(npy, bps, kept, th, tw)) {
+            if (npy) fclose(npy);
+            return 0;
+        }
+    }
+
+    int written = 0;
+    for (int r = 0; r < ny; r++) {
+        for (int c = 0; c < nx; c++) {
+            int k = r * nx + c;
+            if (!(keep[k / 8] & (1 << (k % 8)))) continue;
+            const uint8_t* tile = rgb + (size_t)ys[r] * stride + (size_t)xs[c] * 3 * bps;
+            if (npy) {
+                for (int y = 0; y < th; y++) {
+                    fwrite(tile + (size_t)y * stride, 1, (size_t)tw * 3 * bps, npy);
+                }
+                written++;
+            } else {
+                char path[512];
+                snprintf(path, sizeof(path), "%.*s_r%02d_c%02d.png", stem, filename, r, c);
+                if (save_png_rect(path, tile, tw, th, stride, q->depth, q->png_level)) {
+                    progress_file_done(progress, frame_number, path);
+                    written++;
+                }
+            }
+        }
+    }
+
+    if (npy) {
+        if (fclose(npy) != 0) return 0;
+        progress_file_done(progress, frame_number, npy_path);
+    }
+    return written;
+}
+
+// Threads for one PNG: -png-threads if given; otherwise, for images of a
+// megapixel or more, the cores the other savers leave idle (all of them
+// when only a frame or two is extracted). Builds with libdeflate only use
+// this for an explicit -png-threads.
+static int png_encode_threads(const FrameQueue* q, int width, int height) {
+    if (q->png_threads > 0) return q->png_threads;
+    if ((int64_t)width * height < PNG_PARALLEL_MIN_PIXELS) return 1;
+    int busy = FFMAX(1, FFMIN(NUM_SAVER_THREADS, q->total_frames));
+    return FFMAX(1, cpu_count() / busy);
+}
+
+void* frame_saver_thread(void* arg) {
+    SaverThreadArgs* args = (SaverThreadArgs*)arg;
+    FrameQueue* q = args->queue;
+    ProgressTracker* progress = args->progress;
+
+    AVFrame* frame;
+    int frame_number;
+    double pushed_at;
+
+#ifdef HAVE_WEBP
+    WebpEncoder webp;
+    if (q->format == FORMAT_WEBP && !webp_encoder_init(&webp, q->quality, q->webp_method, q->lossless)) {
+        printf("❌ Invalid WebP settings\n");
+        // Keep draining so the decoder never blocks on a full queue
+        while (queue_pop(q, &frame, &frame_number, &pushed_at)) av_frame_free(&frame);
+        return NULL;
+    }
+#endif
+#ifdef HAVE_LIBDEFLATE
+    PngEncoder png_enc;
+    int have_png_enc = png_encoder_init(&png_enc, q->png_level);
+#endif
+
+    while (queue_pop(q, &frame, &frame_number, &pushed_at)) {
+        char filename[512];
+        format_output_name(filename, sizeof(filename), q->output_pattern, frame_number,
+                           frame_pts(frame), q->time_base, q->pts_origin);
+
+        const int interlaced = q->deinterlace == DEINTERLACE_FAST && frame_is_interlaced(frame);
+
+        // Whether `filename` was written (tiles report their own files)
+        int saved = 0;
+        if (q->fast_mode) {
+            if (strstr(filename, ".yuv") == NULL) {
+                char with_ext[512];
+                snprintf(with_ext, sizeof(with_ext), "%s.yuv", filename);
+                strcpy(filename, with_ext);
+            }
+            if (interlaced) {
+                // Raw planes are written as they are, so they are doubled in place
+                ALLOC_STAGE(ALLOC_STAGE_FILTER);
+                deinterlace_fast(frame);
+            }
+            ALLOC_STAGE(ALLOC_STAGE_ENCODE);
+            saved = save_yuv_frame(frame, filename, frame->width, frame->height);
+#ifdef HAVE_WEBP
+        } else if (q->format == FORMAT_WEBP && q->tile_w == 0 && q->pyramid <= 1) {
+            set_extension(filename, sizeof(filename), ".webp");
+            int square = !q->correct_sar ||
+                         display_width(frame->width, frame->sample_aspect_ratio) == frame->width;
+            if (!q->lossless && q->rotation == 0 && q->fit_w == 0 && square && !interlaced &&
+                !frame_is_hdr(frame) && webp_can_import_yuv(frame)) {
+                ALLOC_STAGE(ALLOC_STAGE_ENCODE);
+                saved = save_webp_yuv420(&webp, filename, frame);
+            } else {
+                ALLOC_STAGE(ALLOC_STAGE_CONVERT);
+                int out_w, out_h;
+                uint8_t* rgb_data = convert_frame_rgb(q, frame, &out_w, &out_h);
+                if (rgb_data) {
+                    ALLOC_STAGE(ALLOC_STAGE_ENCODE);
+                    saved = save_webp_rgb(&webp, filename, rgb_data, out_w, out_h);
+                    free(rgb_data);
+                }
+            }
+#endif
+        } else {
+            if (strstr(filename, ".png") == NULL) {
+                char with_ext[512];
+                snprintf(with_ext, sizeof(with_ext), "%s.png", filename);
+                strcpy(filename, with_ext);
+            }
+
+            ALLOC_STAGE(ALLOC_STAGE_CONVERT);
+            int out_w, out_h;
+            uint8_t* rgb_data = convert_frame_rgb(q, frame, &out_w, &out_h);
+
+            if (rgb_data) {
+                ALLOC_STAGE(ALLOC_STAGE_ENCODE);
+                if (q->tile_w > 0) {
+                    save_tiles(q, progress, frame_number, filename, rgb_data, out_w, out_h);
+                } else if (q->pyramid > 1) {
+                    saved = save_pyramid(q, filename, rgb_data, out_w, out_h);
+                } else {
+                    int threads = png_encode_threads(q, out_w, out_h);
+#ifdef HAVE_LIBDEFLATE
+                    // libdeflate on one core outruns the zlib pool; that
+                    // only runs when -png-threads asks for it
+                    if (have_png_enc && q->png_threads <= 0) threads = 1;
+#endif
+                    if (threads > 1) {
+                        saved = save_png_parallel(filename, rgb_data, out_w, out_h,
+                                                  (size_t)out_w * 3 * (q->depth / 8), q->depth, q->png_level,
+                                                  threads);
+                    } else {
+#ifdef HAVE_LIBDEFLATE
+                        if (have_png_enc) {
+                            saved = save_png_fast(&png_enc, filename, rgb_data, out_w, out_h,
+                                                  (size_t)out_w * 3 * (q->depth / 8), q->depth);
+                        } else
+#endif
+                        saved = save_png(filename, rgb_data, out_w, out_h, q->depth, q->png_level);
+                    }
+                }
+                free(rgb_data);
+            }
+        }
+        if (saved) {
+            if (q->cache && frame_pts(frame) != AV_NOPTS_VALUE) {
+                frame_cache_store(q->cache, frame_pts(frame), filename);
+            }
+            progress_file_done(progress, frame_number, filename);
+        }
+
+        if (q->latencies) {
+            int slot = __atomic_fetch_add(&q->latency_count, 1, __ATOMIC_RELAXED);
+            if (slot < q->total_frames) {
+                q->latencies[slot] = timer_elapsed(q->clock) - pushed_at;
+            }
+        }
+
+        ALLOC_STAGE(ALLOC_STAGE_QUEUE);
+        av_frame_free(&frame);
+        __atomic_fetch_add(&q->frames_saved, 1, __ATOMIC_RELAXED);
+        progress_update(progress, 1, 0);
+    }
+
+#ifdef HAVE_WEBP
+    if (q->format == FORMAT_WEBP) webp_encoder_free(&webp);
+#endif
+#ifdef HAVE_LIBDEFLATE
+    png_encoder_free(&png_enc);
+#endif
+    return NULL;
+}
+
+// ==================== ANIMATION ====================
+
+#define ANIM_PALETTE_FRAMES 8        // frames sampled for the GIF palette
+#define ANIM_PALETTE_SAMPLES 32768   // pixels sampled per frame
+
+typedef struct {
+    int start, end;
+    int range;      // widest channel spread
+    int channel;    // 0 = R, 1 = G, 2 = B
+} ColorBox;
+
+static void color_box_measure(ColorBox* box, const uint32_t* px) {
+    int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+    for (int i = box->start; i < box->end; i++) {
+        for (int c = 0; c < 3; c++) {
+            int v = (px[i] >> (16 - 8 * c)) & 0xFF;
+            if (v < lo[c]) lo[c] = v;
+            if (v > hi[c]) hi[c] = v;
+        }
+    }
+    box->range = 0;
+    box->channel = 0;
+    for (int c = 0; c < 3; c++) {
+        if (hi[c] - lo[c] > box->range) {
+            box->range = hi[c] - lo[c];
+            box->channel = c;
+        }
+    }
+}
+
+// Median cut over packed 0x00RRGGBB samples: the box with the widest
+// channel range (weighted by population) is split at its median until
+// there are 256 boxes; each palette entry is its box's mean.
+static int median_cut(uint32_t* px, int n, uint32_t palette[256]) {
+    ColorBox boxes[256];
+    int count = 0;
+    uint32_t* tmp = (uint32_t*)malloc((size_t)n * sizeof(uint32_t));
+    if (!tmp || n == 0) {
+        free(tmp);
+        return 0;
+    }
+
+    boxes[count] = (ColorBox){0, n, 0, 0};
+    color_box_measure(&boxes[count++], px);
+    while (count < 256) {
+        int best = -1;
+        long best_score = 0;
+        for (int b = 0; b < count; b++) {
+            long score = (long)boxes[b].range * (boxes[b].end - boxes[b].start);
+            if (boxes[b].end - boxes[b].start > 1 && score > best_score) {
+                best = b;
+                best_score = score;
+            }
+        }
+        if (best < 0) break;
+
+        // Counting sort the box on its widest channel, split at the median
+        ColorBox* box = &boxes[best];
+        int shift = 16 - 8 * box->channel;
+        int hist[257] = {0};
+        for (int i = box->start; i < box->end; i++) hist[((px[i] >> shift) & 0xFF) + 1]++;
+        for (int v = 1; v < 257; v++) hist[v] += hist[v - 1];
+        for (int i = box->start; i < box->end; i++) tmp[hist[(px[i] >> shift) & 0xFF]++] = px[i];
+        memcpy(px + box->start, tmp, (size_t)(box->end - box->start) * sizeof(uint32_t));
+
+        int mid = box->start + (box->end - box->start) / 2;
+        boxes[count] = (ColorBox){mid, box->end, 0, 0};
+        color_box_measure(&boxes[count++], px);
+        box->end = mid;
+        color_box_measure(box, px);
+    }
+    free(tmp);
+
+    for (int b = 0; b < count; b++) {
+        uint64_t sum[3] = {0, 0, 0};
+        int len = boxes[b].end - boxes[b].start;
+        for (int i = boxes[b].start; i < boxes[b].end; i++) {
+            for (int c = 0; c < 3; c++) sum[c] += (px[i] >> (16 - 8 * c)) & 0xFF;
+        }
+        palette[b] = 0xFF000000u | (uint32_t)((sum[0] / len) << 16) |
+                     (uint32_t)((sum[1] / len) << 8) | (uint32_t)(sum[2] / len);
+    }
+    return count;
+}
+
+typedef struct {
+    AVFormatContext* oc;
+    AVCodecContext* ctx;
+    AVStream* st;
+    AVFrame* frame;         // PAL8: indices in data[0], palette in data[1]
+    AVPacket* pkt;
+    uint32_t palette[256];
+    uint8_t* lut;           // RGB555 -> palette index
+    uint8_t* pending[ANIM_PALETTE_FRAMES];
+    int64_t pending_pts[ANIM_PALETTE_FRAMES];
+    int pending_count;
+    int width, height;
+    int opened;
+} GifWriter;
+
+static void gif_build_lut(GifWriter* g, int colors) {
+    for (int c = 0; c < 32768; c++) {
+        int r = ((c >> 10) << 3) | 4, gr = (((c >> 5) & 31) << 3) | 4, b = ((c & 31) << 3) | 4;
+        int best = 0, best_d = INT32_MAX;
+        for (int i = 0; i < colors; i++) {
+            int dr = r - (int)((g->palette[i] >> 16) & 0xFF);
+            int dg = gr - (int)((g->palette[i] >> 8) & 0xFF);
+            int db = b - (int)(g->palette[i] & 0xFF);
+            int d = dr * dr * 2 + dg * dg * 4 + db * db * 3;
+            if (d < best_d) {
+                best_d = d;
+                best = i;
+            }
+        }
+        g->lut[c] = (uint8_t)best;
+    }
+}
+
+static int gif_write_frame(GifWriter* g, const uint8_t* rgb, int64_t pts) {
+    if (av_frame_make_writable(g->frame) < 0) return 0;
+    for (int y = 0; y < g->height; y++) {
+        const uint8_t* src = rgb + (size_t)y * g->width * 3;
+        uint8_t* dst = g->frame->data[0] + (size_t)y * g->frame->linesize[0];
+        for (int x = 0; x < g->width; x++, src += 3) {
+            dst[x] = g->lut[((src[0] >> 3) << 10) | ((src[1] >> 3) << 5) | (src[2] >> 3)];
+        }
+    }
+    memcpy(g->frame->data[1], g->palette, sizeof(g->palette));
+    g->frame->pts = pts;
+
+    if (avcodec_send_frame(g->ctx, g->frame) < 0) return 0;
+    while (avcodec_receive_packet(g->ctx, g->pkt) == 0) {
+        av_packet_rescale_ts(g->pkt, g->ctx->time_base, g->st->time_base);
+        g->pkt->stream_index = g->st->index;
+        av_interleaved_write_frame(g->oc, g->pkt);
+    }
+    return 1;
+}
+
+// Builds the palette from the buffered frames, opens the gif encoder and
+// muxer, and writes the buffered frames out.
+static int gif_open(GifWriter* g, const char* path) {
+    int samples_per_frame = FFMIN(ANIM_PALETTE_SAMPLES, g->width * g->height);
+    int stride = FFMAX(1, g->width * g->height / samples_per_frame);
+    uint32_t* samples = (uint32_t*)malloc((size_t)g->pending_count * samples_per_frame * sizeof(uint32_t));
+    g->lut = (uint8_t*)malloc(32768);
+    if (!samples || !g->lut) {
+        free(samples);
+        return 0;
+    }
+    int n = 0;
+    for (int f = 0; f < g->pending_count; f++) {
+        for (int i = 0; i < samples_per_frame; i++) {
+            const uint8_t* p = g->pending[f] + (size_t)i * stride * 3;
+            samples[n++] = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+        }
+    }
+    int colors = median_cut(samples, n, g->palette);
+    free(samples);
+    if (colors == 0) return 0;
+    for (int i = colors; i < 256; i++) g->palette[i] = 0xFF000000u;
+    gif_build_lut(g, colors);
+
+    const AVCodec* enc = avcodec_find_encoder(AV_CODEC_ID_GIF);
+    if (!enc || avformat_alloc_output_context2(&g->oc, NULL, "gif", path) < 0 || !g->oc) return 0;
+    g->st = avformat_new_stream(g->oc, NULL);
+    g->ctx = avcodec_alloc_context3(enc);
+    g->frame = av_frame_alloc();
+    g->pkt = av_packet_alloc();
+    if (!g->st || !g->ctx || !g->frame || !g->pkt) return 0;
+
+    g->ctx->width = g->width;
+    g->ctx->height = g->height;
+    g->ctx->pix_fmt = AV_PIX_FMT_PAL8;
+    g->ctx->time_base = (AVRational){1, 100};   // GIF delays are centiseconds
+    if (avcodec_open2(g->ctx, enc, NULL) < 0) return 0;
+    g->st->time_base = g->ctx->time_base;
+    avcodec_parameters_from_context(g->st->codecpar, g->ctx);
+
+    g->frame->format = AV_PIX_FMT_PAL8;
+    g->frame->width = g->width;
+    g->frame->height = g->height;
+    if (av_frame_get_buffer(g->frame, 0) < 0) return 0;
+    if (avio_open(&g->oc->pb, path, AVIO_FLAG_WRITE) < 0) return 0;
+    if (avformat_write_header(g->oc, NULL) < 0) return 0;
+    g->opened = 1;
+
+    for (int f = 0; f < g->pending_count; f++) {
+        gif_write_frame(g, g->pending[f], g->pending_pts[f]);
+        free(g->pending[f]);
+    }
+    g->pending_count = 0;
+    return 1;
+}
+
+// Takes ownership of rgb. pts is in centiseconds.
+static int gif_add(GifWriter* g, const char* path, uint8_t* rgb, int64_t pts) {
+    if (g->opened) {
+        int ok = gif_write_frame(g, rgb, pts);
+        free(rgb);
+        return ok;
+    }
+    g->pending[g->pending_count] = rgb;
+    g->pending_pts[g->pending_count] = pts;
+    g->pending_count++;
+    return g->pending_count < ANIM_PALETTE_FRAMES || gif_open(g, path);
+}
+
+static int gif_finish(GifWriter* g, const char* path) {
+    int ok = 1;
+    // Short clips never filled the palette sample; a full one already tried
+    if (!g->opened && g->pending_count > 0 && g->pending_count < ANIM_PALETTE_FRAMES) {
+        ok = gif_open(g, path);
+    }
+    if (g->opened) {
+        avcodec_send_frame(g->ctx, NULL);
+        while (avcodec_receive_packet(g->ctx, g->pkt) == 0) {
+            av_packet_rescale_ts(g->pkt, g->ctx->time_base, g->st->time_base);
+            g->pkt->stream_index = g->st->index;
+            av_interleaved_write_frame(g->oc, g->pkt);
+        }
+        ok = av_write_trailer(g->oc) == 0 && ok;
+    }
+    for (int f = 0; f < g->pending_count; f++) free(g->pending[f]);
+    if (g->oc && g->oc->pb) avio_closep(&g->oc->pb);
+    avformat_free_context(g->oc);
+    avcodec_free_context(&g->ctx);
+    av_frame_free(&g->frame);
+    av_packet_free(&g->pkt);
+    free(g->lut);
+    return ok && g->opened;
+}
+
+typedef struct {
+    FrameQueue* queue;
+    ProgressTracker* progress;
+    const char* path;
+    double src_fps;          // frame numbers -> seconds
+    double out_fps;          // <= 0: keep every frame
+    int ok;
+} AnimateArgs;
+
+// Single consumer of the frame queue: frames arrive in decode order, are
+// decimated to the output rate, converted (scaled via -fit) and fed to the
+// GIF or WebP encoder while the decoder keeps running.
+void* animate_thread(void* arg) {
+    AnimateArgs* args = (AnimateArgs*)arg;
+    FrameQueue* q = args->queue;
+    const char* ext = strrchr(args->path, '.');
+    const int webp = ext && strcmp(ext, ".webp") == 0;
+
+    GifWriter gif;
+    memset(&gif, 0, sizeof(gif));
+#ifdef HAVE_WEBP
+    WebPAnimEncoder* anim = NULL;
+    WebPConfig webp_config;
+    WebPPicture pic;
+    WebPConfigPreset(&webp_config, WEBP_PRESET_PHOTO, (float)q->quality);
+    webp_config.method = q->webp_method;
+    webp_config.lossless = q->lossless;
+    WebPPictureInit(&pic);
+#endif
+
+    AVFrame* frame;
+    int frame_number;
+    int first_number = -1;
+    int out_index = 0;
+    double last_ts = 0.0;
+    int ok = 1;
+    int anim_w = 0, anim_h = 0;   // every frame must match the first one's size
+    int mismatched = 0;
+
+    while (queue_pop(q, &frame, &frame_number, NULL)) {
+        int encoded = 0;
+        if (first_number < 0) first_number = frame_number;
+        double t = (frame_number - first_number) / args->src_fps;
+        // Each frame goes in the output slot its own time falls in; the
+        // next frame is taken once it reaches a later slot
+        int slot = args->out_fps > 0 ? (int)floor(t * args->out_fps + 1e-6) : out_index;
+
+        if (ok && slot >= out_index) {
+            double ts = args->out_fps > 0 ? slot / args->out_fps : t;
+            out_index = slot + 1;
+            ALLOC_STAGE(ALLOC_STAGE_CONVERT);
+            int w, h;
+            uint8_t* rgb = convert_frame_rgb(q, frame, &w, &h);
+            ALLOC_STAGE(ALLOC_STAGE_ENCODE);
+            if (rgb && anim_w == 0) {
+                anim_w = w;
+                anim_h = h;
+            }
+            if (!rgb) {
+                ok = 0;
+            } else if (w != anim_w || h != anim_h) {
+                free(rgb);
+                mismatched++;
+            } else if (webp) {
+#ifdef HAVE_WEBP
+                if (!anim) {
+                    WebPAnimEncoderOptions opts;
+                    WebPAnimEncoderOptionsInit(&opts);
+                    anim = WebPAnimEncoderNew(w, h, &opts);
+                }
+                pic.use_argb = 1;
+                pic.width = w;
+                pic.height = h;
+                ok = anim && WebPPictureImportRGB(&pic, rgb, w * 3) &&
+                     WebPAnimEncoderAdd(anim, &pic, (int)lround(ts * 1000.0), &webp_config);
+#endif
+                free(rgb);
+                encoded = ok;
+                last_ts = ts;
+            } else {
+                gif.width = w;
+                gif.height = h;
+                ok = gif_add(&gif, args->path, rgb, llround(ts * 100.0));
+                encoded = ok;
+                last_ts = ts;
+            }
+        }
+
+        ALLOC_STAGE(ALLOC_STAGE_QUEUE);
+        av_frame_free(&frame);
+        // Frames dropped by decimation or size are not output frames
+        if (encoded) {
+            __atomic_fetch_add(&q->frames_saved, 1, __ATOMIC_RELAXED);
+            progress_update(args->progress, 1, 0);
+        }
+    }
+    if (mismatched > 0) {
+        printf("\n⚠️  %d frames skipped: their size differs from the first frame's %dx%d\n",
+               mismatched, anim_w, anim_h);
+    }
+
+    if (webp) {
+#ifdef HAVE_WEBP
+        // The last frame's duration comes from the closing timestamp
+        double end_ts = last_ts + 1.0 / (args->out_fps > 0 ? args->out_fps : args->src_fps);
+        if (anim) {
+            WebPData data;
+            WebPDataInit(&data);
+            ok = ok && WebPAnimEncoderAdd(anim, NULL, (int)lround(end_ts * 1000.0), NULL) &&
+                 WebPAnimEncoderAssemble(anim, &data);
+            if (ok) {
+                FILE* fp = fopen(args->path, "wb");
+                ok = fp && fwrite(data.bytes, 1, data.size, fp) == data.size;
+                if (fp) fclose(fp);
+            }
+            WebPDataClear(&data);
+            WebPAnimEncoderDelete(anim);
+        } else {
+            ok = 0;
+        }
+        WebPPictureFree(&pic);
+#else
+        (void)last_ts;
+        ok = 0;
+#endif
+    } else {
+        ok = gif_finish(&gif, args->path) && ok;
+    }
+
+    if (ok) progress_file_done(args->progress, -1, args->path);
+    args->ok = ok;
+    return NULL;
+}
+
+// ==================== MEDIA EXTRACTOR CONFIG ====================
+
+#define MAX_RANGE_SEGMENTS 64
+
+// One -range or -time-range; several of them share a single run.
+typedef struct {
+    int start_frame;
+    int end_frame;
+    char start_time[64];
+    char end_time[64];
+    int is_time;
+} RangeSegment;
+
+typedef struct {
+    char input[512];
+    char output_pattern[512];
+    char audio_output[512];
+    int frames[1024];
+    int frame_count;
+    int start_frame;
+    int end_frame;
+    int step;
+    int format;
+    int fast_mode;
+    int extract_audio;
+    int audio_only;
+    int audio_format;
+    int audio_bitrate;
+    int use_time;
+    int use_time_range;
+    char time_str[64];
+    char start_time[64];
+    char end_time[64];
+    RangeSegment segments[MAX_RANGE_SEGMENTS];   // every -range/-time-range, in order
+    int segment_count;
+    double* times;             // -times/-times-file, seconds in requested order
+    int times_count;
+    int times_capacity;
+    int snap_nearest;          // -snap nearest: closest frame instead of the one shown
+    char frame_cache[512];     // -frame-cache directory, "" = off
+    int fingerprint;           // -fingerprint: print the input's content key and exit
+    int session;               // -session: serve frame requests from stdin
+    int session_cache_mb;      // -session-cache, decoded frames kept in memory
+    int prefetch;              // -prefetch, frames decoded ahead in -session (-1 = default)
+    double cache_size_gb;      // -cache-size, LRU limit of the cache directory
+    char ytdl_url[1024];      // New: YouTube URL
+    char ytdl_format[64];      // New: yt-dlp format
+    int ytdl_download;         // New: flag for yt-dlp
+    int profile_alloc;
+    int png_level;
+    int microbench;
+    int perfcheck;
+    int perfcheck_update;
+    int perfcheck_runs;
+    char perf_baseline[512];
+    char decoder[64];          // "" = FFmpeg default, "auto" = benchmark
+    int exact_count;           // always build the frame index
+    char filter_graph[1024];   // -vf, libavfilter graph description
+    int depth;                 // PNG bits per sample: 8 or 16
+    int tonemap;               // TONEMAP_* applied to PQ/HLG sources
+    int no_autorotate;         // ignore the stream display matrix
+    int no_sar_correct;        // keep stored width for non-square pixels
+    int deinterlace;           // DEINTERLACE_*, only touches interlaced frames
+    int pyramid;               // total levels including full size
+    int tile_w, tile_h;        // -tiles WxH
+    int tile_overlap;          // -overlap, pixels
+    int tile_batch;            // -tiles-npy
+    double tile_min_variance;  // -tiles-skip-flat
+    int fit_w, fit_h;          // -fit WxH
+    int fit_mode;              // FIT_*
+    uint8_t pad_color[3];      // -pad-color RRGGBB
+    int quality;               // -quality, WebP
+    int webp_method;           // -webp-method
+    int lossless;              // -lossless, WebP
+    char animate_path[512];    // -animate out.gif|out.webp
+    double animate_fps;        // -fps, output rate (0 = source rate)
+    int animate_scale;         // -scale, output width (0 = source width)
+    int png_threads;           // -png-threads, 0 = auto
+    int passthrough;           // copy MJPEG/PNG packets without decoding
+} Config;
+
+void print_usage() {
+    printf("\n🎬 === Frame Extractor v10.0 (YOUTUBE EDITION) ===\n");
+    printf("Extract frames/audio from local videos OR YouTube URLs!\n\n");
+    printf("Usage: frame_extractor -input <video> [options]\n");
+    printf("   OR: frame_extractor -ytdl <url> [options]\n\n");
+
+    printf("📹 FRAME OPTIONS:\n");
+    printf("  -output <pattern>     Output filename pattern (e.g., frame_%%03d.png)\n");
+    printf("                         %%t = media time HH-MM-SS.mmm, %%p = raw PTS\n");
+    printf("  -frame <n>            Extract single frame\n");
+    printf("  -frames <n1,n2,n3>    Extract specific frames\n");
+    printf("  -range <start> <end>  Extract range of frames (repeatable)\n");
+    printf("  -step <n>             Step for range extraction\n");
+    printf("  -time <time>          Extract frame at time\n");
+    printf("  -time-range <start> <end>  Extract frames between times (repeatable)\n");
+    printf("  -times <t1,t2,...>    Extract frames at these times; %%d names by list position\n");
+    printf("  -times-file <file>    Read -times from a file (one or more per line, # comments)\n");
+    printf("  -snap <preceding|nearest>  Frame on screen at each time, or closest PTS\n");
+    printf("  -fast                  FAST MODE: save raw YUV\n");
+    printf("  -passthrough          MJPEG/PNG streams: write packets as .jpg/.png, no decoding\n");
+    printf("  -vf <graph>           libavfilter graph applied before saving\n");
+    printf("                         (e.g. \"yadif,scale=1280:-2,eq=contrast=1.2\")\n");
+    printf("  -decoder <name|auto>  Decoder implementation (auto = fastest, cached)\n");
+    printf("  -exact-count          Index every frame's PTS even if the header has a count\n");
+    printf("  -frame-cache <dir>    Reuse outputs from earlier runs on the same content\n");
+    printf("  -cache-size <GB>      Cache size limit, least recently used evicted (default: 4)\n");
+    printf("  -fingerprint          Print the input's sampled content fingerprint and exit\n");
+    printf("  -session              Keep the input open and serve frame requests from stdin\n");
+    printf("                         (<n> | frame <n> | time <t> | quit), one PNG per request\n");
+    printf("  -session-cache <MB>   Decoded frames kept in memory by -session (default: 512)\n");
+    printf("  -prefetch <n>         -session: decode n frames ahead of sequential, strided or\n");
+    printf("                         reverse access on a second decoder (default: 8, 0 = off)\n");
+    printf("  -compression <0-9>    PNG zlib level (default: libpng default)\n");
+    printf("  -png-threads <n>      Deflate threads per PNG (default: auto for large frames)\n");
+    printf("  -depth <8|16>         PNG bits per sample (16 keeps 10/12-bit precision)\n");
+    printf("  -tonemap <hable|reinhard>  Tonemap PQ/HLG HDR sources to SDR\n");
+    printf("  -no-autorotate        Don't apply the stream's display rotation\n");
+    printf("  -no-sar-correct       Don't stretch non-square pixels to display aspect\n");
+    printf("  -deinterlace <fast|bwdif>  Deinterlace frames flagged interlaced\n");
+    printf("                         (fast = line doubler, bwdif = libavfilter)\n");
+    printf("  -pyramid <levels>     Also write 1/2, 1/4, ... sizes as <name>_L<n>.png\n");
+    printf("  -tiles <WxH>          Write WxH tiles as <name>_rNN_cNN.png\n");
+    printf("  -overlap <px>         Pixels shared by neighbouring tiles\n");
+    printf("  -tiles-npy            Write each frame's tiles as one NHWC .npy batch\n");
+    printf("  -tiles-skip-flat <v>  Skip tiles with sample variance below v\n");
+    printf("  -fit <WxH> [letterbox|crop|stretch]  Resize to a fixed size (default letterbox)\n");
+    printf("  -pad-color <RRGGBB>   Letterbox bar colour (default 000000)\n");
+    printf("  -format <png|webp>    Image format (webp needs a -DHAVE_WEBP build)\n");
+    printf("  -quality <0-100>      WebP quality (default: 80)\n");
+    printf("  -webp-method <0-6>    WebP speed/size tradeoff (default: 4)\n");
+    printf("  -lossless             Lossless WebP\n");
+    printf("  -animate <out.gif|out.webp>  Encode the selected frames as one animation\n");
+    printf("  -fps <r>              Animation frame rate (default: source rate)\n");
+    printf("  -scale <w>            Animation width, height keeps the aspect\n\n");
+
+    printf("📊 PROFILING OPTIONS:\n");
+    printf("  -profile-alloc        Report allocations per frame/stage and peak RSS\n");
+    printf("  -microbench           Benchmark the hot primitives (no input needed)\n");
+    printf("  -perfcheck            Run the scenario matrix against the baseline\n");
+    printf("  -perfcheck-update     Run the scenario matrix and record the baseline\n");
+    printf("  -perfcheck-runs <n>   Runs per scenario (default: 5)\n");
+    printf("  -progress-json <fd|file>  JSON-lines progress and per-file events\n");
+    printf("  -quiet                No progress bar or messages on stdout\n");
+    printf("  -baseline <file>      Baseline JSON (default: perf_baseline.json)\n\n");
+
+    printf("🎵 AUDIO OPTIONS:\n");
+    printf("  -extract-audio        Extract audio along with frames\n");
+    printf("  -audio-only           Extract audio only\n");
+    printf("  -output-audio <file>  Audio output filename\n");
+    printf("  -audio-format <fmt>   mp3, aac, wav, ogg (default: mp3)\n");
+    printf("  -audio-bitrate <kbps> Bitrate for audio (32-320, default: 128)\n\n");
+
+    printf("🌐 YOUTUBE OPTIONS (NEW!):\n");
+    printf("  -ytdl <url>           Download from YouTube first\n");
+    printf("  -ytdl-format <fmt>    yt-dlp format (default: auto)\n");
+    printf("                         auto = best for your needs\n\n");
+
+    printf("🚀 YOUTUBE EXAMPLES:\n");
+    printf("  # Download and extract audio\n");
+    printf("  frame_extractor -ytdl \"https://youtu.be/...\" -audio-only -output-audio song.mp3\n\n");
+    printf("  # Download and extract frame at 1:30\n");
+    printf("  frame_extractor -ytdl \"https://youtu.be/...\" -time 00:01:30 -output thumbnail.png\n\n");
+    printf("  # Download best video, extract frames 100-200\n");
+    printf("  frame_extractor -ytdl \"https://youtu.be/...\" -range 100 200 -output frames/%%03d.png\n");
+}
+
+int parse_frames_string(const char* str, int* frames, int* count) {
+    char temp[1024];
+    strcpy(temp, str);
+    *count = 0;
+
+    char* token = strtok(temp, ",");
+    while (token != NULL && *count < 1024) {
+        frames[*count] = atoi(token);
+        (*count)++;
+        token = strtok(NULL, ",");
+    }
+    return *count > 0;
+}
+
+// Accepts HH:MM:SS[.fff], MM:SS[.fff] or plain seconds.
+double parse_time_seconds(const char* time_str) {
+    int h, m;
+    double sec;
+
+    if (sscanf(time_str, "%d:%d:%lf", &h, &m, &sec) == 3) {
+        return h * 3600 + m * 60 + sec;
+    } else if (sscanf(time_str, "%d:%lf", &m, &sec) == 2) {
+        return m * 60 + sec;
+    }
+    return atof(time_str);
+}
+
+int parse_time_to_frame(const char* time_str, double fps) {
+    return (int)(parse_time_seconds(time_str) * fps);
+}
+
+int64_t time_to_pts(const char* time_str, AVRational time_base) {
+    return (int64_t)(parse_time_seconds(time_str) * time_base.den / time_base.num);
+}
+
+static int add_time_request(Config* config, double seconds) {
+    if (config->times_count == config->times_capacity) {
+        int capacity = config->times_capacity ? config->times_capacity * 2 : 64;
+        double* grown = (double*)realloc(config->times, capacity * sizeof(double));
+        if (!grown) return 0;
+        config->times = grown;
+        config->times_capacity = capacity;
+    }
+    config->times[config->times_count++] = seconds;
+    return 1;
+}
+
+// Appends the timestamps in str (comma, space or newline separated, each
+// in any -time format). Text after '#' on a line is a comment.
+int parse_times_string(const char* str, Config* config) {
+    char* copy = strdup(str);
+    if (!copy) return 0;
+    for (char* line = copy; line; ) {
+        char* eol = strchr(line, '\n');
+        if (eol) *eol++ = '\0';
+        char* hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        for (char* tok = strtok(line, ", \t\r"); tok; tok = strtok(NULL, ", \t\r")) {
+            if (!add_time_request(config, parse_time_seconds(tok))) {
+                free(copy);
+                return 0;
+            }
+        }
+        line = eol;
+    }
+    free(copy);
+    return 1;
+}
+
+int load_times_file(const char* path, Config* config) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return 0;
+    char line[1024];
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), fp)) {
+        ok = parse_times_string(line, config);
+    }
+    fclose(fp);
+    return ok;
+}
+
+static int compare_ints(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_int64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+int frame_in_list(int frame, const int* list, int count) {
+    for (int i = 0; i < count; i++) {
+        if (list[i] == frame) return 1;
+    }
+    return 0;
+}
+
+// ==================== PATH FIXING FOR WINDOWS ====================
+
+void fix_windows_path(char* path) {
+    for (int i = 0; path[i]; i++) {
+        if (path[i] == '\\') {
+            path[i] = '/';
+        }
+    }
+}
+
+// ==================== YT-DLP DOWNLOAD FUNCTION ====================
+
+int download_from_youtube(Config* config) {
+    printf("\n🌐 === YOUTUBE DOWNLOAD ===\n");
+
+    // Check if yt-dlp is installed
+    if (system("yt-dlp --version > /dev/null 2>&1") != 0) {
+        printf("❌ yt-dlp not found! Install with: pip install yt-dlp\n");
+        return 0;
+    }
+
+    // Smart format selection
+    const char* format;
+    if (config->audio_only) {
+        format = "bestaudio";
+        printf("🎵 Audio-only mode: downloading best audio\n");
+    }
+    else if (config->frame_count > 0 || config->times_count > 0 || config->use_time_range ||
+             config->start_frame > 0) {
+        format = "bestvideo[ext=mp4]";
+        printf("📹 Frame extraction: downloading best video\n");
+    }
+    else if (config->extract_audio) {
+        format = "bestvideo+bestaudio";
+        printf("🎬 Video+Audio: downloading both\n");
+    }
+    else {
+        format = "best[ext=mp4]";
+        printf("📥 Default: downloading best MP4\n");
+    }
+
+    // Use custom format if specified
+    if (config->ytdl_format[0] != '\0') {
+        format = config->ytdl_format;
+        printf("📥 Using custom format: %s\n", format);
+    }
+
+    // Build download command
+    char cmd[4096];
+    snprintf(cmd, sizeof(cmd),
+             "yt-dlp -f '%s' --newline --progress -o 'ytdl_%%(title)s.%%(ext)s' '%s'",
+             format, config->ytdl_url);
+
+    printf("\n🔄 Downloading...\n");
+    fflush(stdout);
+
+    // Run download and show progress
+    FILE* fp = popen(cmd, "r");
+    if (!fp) {
+        printf("❌ Failed to run yt-dlp\n");
+        return 0;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strstr(line, "[download]") && strstr(line, "%")) {
+            // Extract percentage
+            char* percent_str = strstr(line, " ");
+            if (percent_str) {
+                percent_str++;
+                char* end = strchr(percent_str, '%');
+                if (end) *end = '\0';
+                printf("\r   ⬇️  Downloaded: %s%%", percent_str);
+                fflush(stdout);
+            }
+        }
+    }
+
+    int status = pclose(fp);
+    if (status != 0) {
+        printf("\n❌ Download failed!\n");
+        return 0;
+    }
+
+    printf("\r   ⬇️  Download complete!          \n");
+
+    // Find the downloaded file
+    FILE* ls_fp = popen("ls ytdl_* 2>/dev/null | head -1", "r");
+    if (!ls_fp) {
+        printf("❌ Cannot find downloaded file\n");
+        return 0;
+    }
+    
+    char downloaded_filename[512];  // ← USE A TEMPORARY BUFFER
+    if (fgets(downloaded_filename, sizeof(downloaded_filename), ls_fp) == NULL) {
+        printf("❌ No downloaded file found\n");
+        pclose(ls_fp);
+        return 0;
+    }
+    pclose(ls_fp);
+    
+    // Remove newline from temporary buffer
+    downloaded_filename[strcspn(downloaded_filename, "\n")] = '\0';
+    
+    printf("📂 Downloaded: %s\n", config->input);
+    return 1;
+}
+
+// ==================== FFMPEG AUDIO EXTRACTION ====================
+
+const char* get_audio_codec(int format) {
+    switch(format) {
+        case 0: return "libmp3lame";
+        case 1: return "aac";
+        case 2: return "pcm_s16le";
+        case 3: return "libvorbis";
+        default: return "libmp3lame";
+    }
+}
+
+const char* get_audio_extension(int format) {
+    switch(format) {
+        case 0: return "mp3";
+        case 1: return "m4a";
+        case 2: return "wav";
+        case 3: return "ogg";
+        default: return "mp3";
+    }
+}
+
+const char* get_bitrate_option(int format, int bitrate) {
+    static char option[64];
+    if (bitrate <= 0) bitrate = 128;
+    snprintf(option, sizeof(option), "-b:a %dk", bitrate);
+    return option;
+}
+
+void* extract_audio_thread(void* arg) {
+    Config* config = (Config*)arg;
+
+    printf("\n🎵 === AUDIO EXTRACTION (FFmpeg) ===\n");
+
+    // Check if ffmpeg is installed
+    if (system("ffmpeg -version > /dev/null 2>&1") != 0) {
+        printf("❌ FFmpeg not found! Install with: pkg install ffmpeg\n");
+        return NULL;
+    }
+
+    const char* codec = get_audio_codec(config->audio_format);
+    const char* ext = get_audio_extension(config->audio_format);
+    const char* bitrate_opt = get_bitrate_option(config->audio_format, config->audio_bitrate);
+
+    char final_output[512];
+    strcpy(final_output, config->audio_output);
+
+    if (strstr(final_output, ".") == NULL) {
+        char temp[512];
+        snprintf(temp, sizeof(temp), "%s.%s", config->audio_output, ext);
+        strcpy(final_output, temp);
+    }
+
+    char fixed_input[512];
+    strcpy(fixed_input, config->input);
+    fix_windows_path(fixed_input);
+    fix_windows_path(final_output);
+
+    printf("📂 Input: %s\n", fixed_input);
+    printf("📂 Output: %s\n", final_output);
+    printf("🎵 Format: %s (%s)\n", ext, codec);
+    if (config->audio_bitrate > 0) printf("🎚️ Bitrate: %d kbps\n", config->audio_bitrate);
+
+    char time_option[256] = "";
+    if (config->use_time_range) {
+        double start_seconds = 0, end_seconds = 0;
+        int h, m, s;
+
+        if (sscanf(config->start_time, "%d:%d:%d", &h, &m, &s) == 3) start_seconds = h * 3600 + m * 60 + s;
+        else if (sscanf(config->start_time, "%d:%d", &m, &s) == 2) start_seconds = m * 60 + s;
+        else start_seconds = atof(config->start_time);
+
+        if (sscanf(config->end_time, "%d:%d:%d", &h, &m, &s) == 3) end_seconds = h * 3600 + m * 60 + s;
+        else if (sscanf(config->end_time, "%d:%d", &m, &s) == 2) end_seconds = m * 60 + s;
+        else end_seconds = atof(config->end_time);
+
+        double duration = end_seconds - start_seconds;
+        if (duration > 0) {
+            snprintf(time_option, sizeof(time_option), "-ss %.3f -t %.3f", start_seconds, duration);
+            printf("⏱️ Time range: %.2fs to %.2fs\n", start_seconds, end_seconds);
+        }
+    }
+
+    char command[8192];
+    snprintf(command, sizeof(command),
+             "ffmpeg -i \"%s\" %s -vn %s -acodec %s -y \"%s\" 2>&1",
+             fixed_input, time_option, bitrate_opt, codec, final_output);
+
+    printf("\n🔄 Running FFmpeg...\n");
+    fflush(stdout);
+
+    FILE* fp = popen(command, "r");
+    if (!fp) { printf("❌ Failed to run FFmpeg\n"); return NULL; }
+
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strstr(line, "size=") || strstr(line, "time=")) {
+            char* time_str = strstr(line, "time=");
+            if (time_str) {
+                time_str += 5;
+                char* end = strchr(time_str, ' ');
+                if (end) *end = '\0';
+                printf("\r   ⏱️ %s", time_str);
+                fflush(stdout);
+            }
+        }
+    }
+
+    int status = pclose(fp);
+    if (status == 0) printf("\n\n✅ Audio extraction complete!\n");
+    else printf("\n\n❌ FFmpeg failed with code %d\n", status);
+
+    return NULL;
+}
+
+// ==================== DECODER SELECTION ====================
+
+#define DECODER_BENCH_MAX_PACKETS 300
+#define DECODER_BENCH_RUNS 2
+#define DECODER_CACHE_FILE "decoders.txt"
+
+// Per-user cache directory for decoder choices; created on demand.
+static int decoder_cache_path(char* path, size_t size) {
+#ifdef _WIN32
+    const char* base = getenv("LOCALAPPDATA");
+    if (!base) return 0;
+    snprintf(path, size, "%s\\frame_extractor", base);
+    MKDIR(path);
+#else
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    char dir[512];
+    if (xdg && xdg[0]) {
+        snprintf(dir, sizeof(dir), "%s", xdg);
+    } else if (home && home[0]) {
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+    } else {
+        return 0;
+    }
+    MKDIR(dir);
+    snprintf(path, size, "%s/frame_extractor", dir);
+    MKDIR(path);
+#endif
+    size_t len = strlen(path);
+    snprintf(path + len, size - len, "%s%s", PATH_SEP_STR, DECODER_CACHE_FILE);
+    return 1;
+}
+
+// Cache lines look like "<codec> <width>x<height> <decoder>".
+static int decoder_cache_lookup(const char* key, char* decoder, size_t size) {
+    char path[1024];
+    if (!decoder_cache_path(path, sizeof(path))) return 0;
+
+    FILE* fp = fopen(path, "r");
+    if (!fp) return 0;
+
+    char line[256];
+    int found = 0;
+    size_t key_len = strlen(key);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strncmp(line, key, key_len) == 0 && line[key_len] == ' ') {
+            snprintf(decoder, size, "%s", line + key_len + 1);
+            found = 1;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+static void decoder_cache_store(const char* key, const char* decoder) {
+    char path[1024];
+    if (!decoder_cache_path(path, sizeof(path))) return;
+
+    // Appending is enough: lookup keeps the last matching line.
+    FILE* fp = fopen(path, "a");
+    if (!fp) return;
+    fprintf(fp, "%s %s\n", key, decoder);
+    fclose(fp);
+}
+
+// Reads the first GOP (up to the second keyframe) of the video stream with
+// a separate demuxer so the caller's read position is untouched.
+static int read_first_gop(const char* input, int stream_idx, AVPacket** packets, int max_packets) {
+    AVFormatContext* fmt_ctx = NULL;
+    if (avformat_open_input(&fmt_ctx, input, NULL, NULL) != 0) return 0;
+    avformat_find_stream_info(fmt_ctx, NULL);
+
+    int count = 0;
+    int keyframes = 0;
+    AVPacket* pkt = av_packet_alloc();
+    while (count < max_packets && av_read_frame(fmt_ctx, pkt) >= 0) {
+        if (pkt->stream_index == stream_idx) {
+            if (pkt->flags & AV_PKT_FLAG_KEY) {
+                if (++keyframes == 2) {
+                    av_packet_unref(pkt);
+                    break;
+                }
+            }
+            if (keyframes > 0) {
+                packets[count++] = av_packet_clone(pkt);
+            }
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&fmt_ctx);
+    return count;
+}
+
+// Decodes the packets with the given decoder and returns frames/second, or
+// a negative value if the decoder cannot handle the stream.
+static double benchmark_decoder(const AVCodec* dec, const AVCodecParameters* par,
+                                AVPacket** packets, int count) {
+    AVCodecContext* ctx = avcodec_alloc_context3(dec);
+    if (!ctx) return -1;
+    if (avcodec_parameters_to_context(ctx, par) < 0 || avcodec_open2(ctx, dec, NULL) < 0) {
+        avcodec_free_context(&ctx);
+        return -1;
+    }
+
+    AVFrame* frame = av_frame_alloc();
+    int frames = 0;
+    int failed = 0;
+    Timer t;
+    timer_start(&t);
+    for (int i = 0; i <= count && !failed; i++) {
+        if (avcodec_send_packet(ctx, i < count ? packets[i] : NULL) < 0 && i < count) {
+            failed = 1;
+            break;
+        }
+        int ret;
+        while ((ret = avcodec_receive_frame(ctx, frame)) == 0) {
+            frames++;
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) failed = 1;
+    }
+    double elapsed = timer_elapsed(t);
+
+    av_frame_free(&frame);
+    avcodec_free_context(&ctx);
+    if (failed || frames == 0) return -1;
+    return frames / (elapsed > 1e-6 ? elapsed : 1e-6);
+}
+
+static const AVCodec* benchmark_decoders(const char* input, int stream_idx,
+                                         const AVCodecParameters* par) {
+    AVPacket* packets[DECODER_BENCH_MAX_PACKETS];
+    int count = read_first_gop(input, stream_idx, packets, DECODER_BENCH_MAX_PACKETS);
+    if (count == 0) return NULL;
+
+    printf("\n🏎️ Benchmarking %s decoders on the first GOP (%d packets):\n",
+           avcodec_get_name(par->codec_id), count);
+
+    const AVCodec* best = NULL;
+    double best_fps = 0;
+    void* iter = NULL;
+    const AVCodec* dec;
+    while ((dec = av_codec_iterate(&iter)) != NULL) {
+        if (!av_codec_is_decoder(dec) || dec->id != par->codec_id) continue;
+        if (dec->capabilities & AV_CODEC_CAP_EXPERIMENTAL) continue;
+
+        // Best of several runs, so the first candidate doesn't pay for the
+        // cold caches on its own
+        double fps = -1;
+        for (int run = 0; run < DECODER_BENCH_RUNS; run++) {
+            double run_fps = benchmark_decoder(dec, par, packets, count);
+            if (run_fps < 0) {
+                fps = -1;
+                break;
+            }
+            fps = FFMAX(fps, run_fps);
+        }
+        if (fps < 0) {
+            printf("   %-20s unusable\n", dec->name);
+            continue;
+        }
+        printf("   %-20s %8.1f fps\n", dec->name, fps);
+        if (fps > best_fps) {
+            best_fps = fps;
+            best = dec;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        av_packet_free(&packets[i]);
+    }
+    return best;
+}
+
+// Picks the decoder for the video stream according to -decoder. Returns
+// NULL (after printing why) if the requested decoder is unusable.
+const AVCodec* select_decoder(Config* config, int stream_idx, const AVCodecParameters* par) {
+    const AVCodec* fallback = avcodec_find_decoder(par->codec_id);
+
+    if (config->decoder[0] == '\0') {
+        if (!fallback) printf("❌ No decoder for %s\n", avcodec_get_name(par->codec_id));
+        return fallback;
+    }
+
+    if (strcmp(config->decoder, "auto") != 0) {
+        const AVCodec* dec = avcodec_find_decoder_by_name(config->decoder);
+        if (!dec || dec->id != par->codec_id) {
+            printf("❌ Decoder '%s' cannot decode %s\n", config->decoder,
+                   avcodec_get_name(par->codec_id));
+            return NULL;
+        }
+        printf("🧩 Decoder: %s\n", dec->name);
+        return dec;
+    }
+
+    char key[128];
+    snprintf(key, sizeof(key), "%s %dx%d", avcodec_get_name(par->codec_id), par->width, par->height);
+
+    char cached[64];
+    if (decoder_cache_lookup(key, cached, sizeof(cached))) {
+        const AVCodec* dec = avcodec_find_decoder_by_name(cached);
+        if (dec && dec->id == par->codec_id) {
+            printf("🧩 Decoder: %s (cached for %s)\n", dec->name, key);
+            return dec;
+        }
+    }
+
+    const AVCodec* best = benchmark_decoders(config->input, stream_idx, par);
+    if (!best) {
+        printf("⚠️  Decoder benchmark failed, using FFmpeg default\n");
+        return fallback;
+    }
+
+    decoder_cache_store(key, best->name);
+    printf("🧩 Decoder: %s (fastest, cached for %s)\n", best->name, key);
+    return best;
+}
+
+// ==================== FRAME INDEX ====================
+
+// Exact frame-number -> PTS table in presentation order, built without
+// decoding anything.
+typedef struct {
+    int64_t pts;
+    int64_t pos;        // byte position of the packet, -1 if unknown
+    int keyframe;
+} FrameIndexEntry;
+
+typedef struct {
+    FrameIndexEntry* entries;
+    int count;
+    int capacity;
+    int from_container; // taken from the container sample tables
+} FrameIndex;
+
+#ifndef AVINDEX_DISCARD_FRAME
+#define AVINDEX_DISCARD_FRAME 0x0004
+#endif
+#ifndef AV_PKT_FLAG_DISCARD
+#define AV_PKT_FLAG_DISCARD 0x0004
+#endif
+
+static int frame_index_add(FrameIndex* idx, int64_t pts, int64_t pos, int keyframe) {
+    if (idx->count == idx->capacity) {
+        int capacity = idx->capacity ? idx->capacity * 2 : 4096;
+        FrameIndexEntry* grown = (FrameIndexEntry*)realloc(idx->entries, capacity * sizeof(FrameIndexEntry));
+        if (!grown) return 0;
+        idx->entries = grown;
+        idx->capacity = capacity;
+    }
+    idx->entries[idx->count].pts = pts;
+    idx->entries[idx->count].pos = pos;
+    idx->entries[idx->count].keyframe = keyframe;
+    idx->count++;
+    return 1;
+}
+
+static int compare_index_entries(const void* a, const void* b) {
+    int64_t x = ((const FrameIndexEntry*)a)->pts, y = ((const FrameIndexEntry*)b)->pts;
+    return (x > y) - (x < y);
+}
+
+void frame_index_free(FrameIndex* idx) {
+    free(idx->entries);
+    memset(idx, 0, sizeof(FrameIndex));
+}
+
+#define INDEX_PROBE_PACKETS 16
+
+// MP4/MOV: the demuxer already expanded stts/stsz/stco/stss into one index
+// entry per sample while opening the file (edit-list drops are flagged), so
+// the table costs nothing to build. Entries carry DTS; with B-frames the
+// presentation timestamps are the same set shifted by the reorder delay,
+// which is learned from the first few packets. That only holds for a
+// constant delay, so the shifted table must contain every probed PTS.
+// Returns 1 on success, 0 when there is no table, and -1 when the table
+// cannot give exact PTS (variable rate or delay); exact numbering then
+// needs a packet scan.
+static int frame_index_from_container(FrameIndex* idx, AVFormatContext* fmt_ctx, int stream_idx) {
+    if (!fmt_ctx->iformat || !strstr(fmt_ctx->iformat->name, "mov")) return 0;
+
+    AVStream* st = fmt_ctx->streams[stream_idx];
+    int entries = avformat_index_get_entries_count(st);
+    if (entries <= 0) return 0;
+    if (av_cmp_q(st->avg_frame_rate, st->r_frame_rate) != 0) return -1;
+
+    for (int i = 0; i < entries; i++) {
+        const AVIndexEntry* e = avformat_index_get_entry(st, i);
+        if (!e || (e->flags & AVINDEX_DISCARD_FRAME)) continue;
+        if (!frame_index_add(idx, e->timestamp, e->pos, (e->flags & AVINDEX_KEYFRAME) != 0)) {
+            frame_index_free(idx);
+            return 0;
+        }
+    }
+    if (idx->count == 0) return 0;
+
+    qsort(idx->entries, idx->count, sizeof(FrameIndexEntry), compare_index_entries);
+
+    AVFormatContext* probe = NULL;
+    if (avformat_open_input(&probe, fmt_ctx->url, NULL, NULL) != 0) {
+        frame_index_free(idx);
+        return -1;
+    }
+    int64_t probed[INDEX_PROBE_PACKETS];
+    int64_t min_pts = INT64_MAX, min_dts = INT64_MAX;
+    int seen = 0;
+    AVPacket* pkt = av_packet_alloc();
+    for (unsigned i = 0; i < probe->nb_streams; i++) {
+        if ((int)i != stream_idx) probe->streams[i]->discard = AVDISCARD_ALL;
+    }
+    while (pkt && seen < INDEX_PROBE_PACKETS && av_read_frame(probe, pkt) >= 0) {
+        if (pkt->stream_index == stream_idx && !(pkt->flags & AV_PKT_FLAG_DISCARD)) {
+            if (pkt->pts != AV_NOPTS_VALUE && pkt->pts < min_pts) min_pts = pkt->pts;
+            if (pkt->dts != AV_NOPTS_VALUE && pkt->dts < min_dts) min_dts = pkt->dts;
+            probed[seen++] = pkt->pts;
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&probe);
+
+    if (min_pts != INT64_MAX && min_dts != INT64_MAX && min_pts != min_dts) {
+        int64_t shift = min_pts - min_dts;
+        for (int i = 0; i < idx->count; i++) {
+            idx->entries[i].pts += shift;
+        }
+    }
+
+    // A constant shift keeps the table sorted, so each probe is a bsearch
+    for (int i = 0; i < seen; i++) {
+        FrameIndexEntry key = {probed[i], 0, 0};
+        if (probed[i] == AV_NOPTS_VALUE ||
+            !bsearch(&key, idx->entries, idx->count, sizeof(FrameIndexEntry), compare_index_entries)) {
+            frame_index_free(idx);
+            return -1;
+        }
+    }
+
+    idx->from_container = 1;
+    return 1;
+}
+
+// Any other container: read every packet of the video stream (other streams
+// are discarded in the demuxer) and sort the PTS to undo B-frame reordering.
+static int frame_index_scan_packets(FrameIndex* idx, const char* input, int stream_idx) {
+    AVFormatContext* fmt_ctx = NULL;
+    if (avformat_open_input(&fmt_ctx, input, NULL, NULL) != 0) return 0;
+    if (stream_idx >= (int)fmt_ctx->nb_streams) {
+        avformat_close_input(&fmt_ctx);
+        return 0;
+    }
+    for (unsigned i = 0; i < fmt_ctx->nb_streams; i++) {
+        if ((int)i != stream_idx) fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    AVPacket* pkt = av_packet_alloc();
+    int ok = 1;
+    while (ok && av_read_frame(fmt_ctx, pkt) >= 0) {
+        if (pkt->stream_index == stream_idx && !(pkt->flags & AV_PKT_FLAG_DISCARD)) {
+            int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+            ok = frame_index_add(idx, ts, pkt->pos, (pkt->flags & AV_PKT_FLAG_KEY) != 0);
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&fmt_ctx);
+
+    if (!ok || idx->count == 0) {
+        frame_index_free(idx);
+        return 0;
+    }
+    qsort(idx->entries, idx->count, sizeof(FrameIndexEntry), compare_index_entries);
+    return 1;
+}
+
+int frame_index_build(FrameIndex* idx, AVFormatContext* fmt_ctx, const char* input, int stream_idx) {
+    memset(idx, 0, sizeof(FrameIndex));
+    if (frame_index_from_container(idx, fmt_ctx, stream_idx) > 0) return 1;
+    return frame_index_scan_packets(idx, input, stream_idx);
+}
+
+// Frame number whose PTS is exactly pts, or -1.
+int frame_index_lookup(const FrameIndex* idx, int64_t pts) {
+    int lo = 0, hi = idx->count - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (idx->entries[mid].pts == pts) return mid;
+        if (idx->entries[mid].pts < pts) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+// Last frame shown at or before pts (0 if pts precedes the first frame).
+int frame_index_at_or_before(const FrameIndex* idx, int64_t pts) {
+    int lo = 0, hi = idx->count - 1, found = 0;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (idx->entries[mid].pts <= pts) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+// Media time (seconds from the first frame) -> frame number.
+int frame_index_time_to_frame(const FrameIndex* idx, double seconds, AVRational time_base) {
+    if (idx->count == 0) return 0;
+    int64_t pts = idx->entries[0].pts + (int64_t)llround(seconds / av_q2d(time_base));
+    return frame_index_at_or_before(idx, pts);
+}
+
+// Frame for a -times request: the one on screen at `seconds`, or with
+// nearest set the one whose PTS is closest. Falls back to the frame rate
+// without an index.
+int frame_index_resolve_time(const FrameIndex* idx, double seconds, AVRational time_base,
+                             double fps, int nearest) {
+    if (idx->count == 0) {
+        double f = seconds * fps;
+        return nearest ? (int)llround(f) : (int)floor(f + 1e-6);
+    }
+    int64_t pts = idx->entries[0].pts + (int64_t)llround(seconds / av_q2d(time_base));
+    int n = frame_index_at_or_before(idx, pts);
+    if (nearest && n + 1 < idx->count &&
+        idx->entries[n + 1].pts - pts < pts - idx->entries[n].pts) {
+        n++;
+    }
+    return n;
+}
+
+// Keyframe that decoding frame n has to start from.
+int frame_index_gop_start(const FrameIndex* idx, int n) {
+    if (n >= idx->count) return -1;
+    while (n > 0 && !idx->entries[n].keyframe) n--;
+    return n;
+}
+
+// PTS to seek to for frame n: exact from the index, else estimated from
+// the frame rate.
+int64_t frame_index_seek_pts(const FrameIndex* idx, const AVStream* st, AVRational frame_duration, int n) {
+    if (n < idx->count) return idx->entries[n].pts;
+    int64_t first_pts = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+    return first_pts + av_rescale_q(n, frame_duration, st->time_base);
+}
+
+#define SEGMENT_SEEK_GAP 250   // without an index, seek over gaps of this many frames
+
+// Whether seeking from frame `from` to frame `to` saves decoding. The seek
+// lands on the keyframe at or before `to`, so it only pays off when one
+// lies after `from`.
+int frame_index_seek_helps(const FrameIndex* idx, int from, int to) {
+    if (to >= idx->count) return to - from >= SEGMENT_SEEK_GAP;
+    for (int k = to; k > from; k--) {
+        if (idx->entries[k].keyframe) return 1;
+    }
+    return 0;
+}
+
+// ==================== FRAME SELECTION ====================
+
+// Decides which decoded frames are wanted and hands them to the savers.
+typedef struct {
+    FrameQueue* queue;
+    const int* frames;     // sorted explicit list (-frames, segments), NULL for start/end/step
+    int start_frame;
+    int end_frame;
+    int step;
+    int wanted;            // frames to queue in total
+    int queued;
+    const int* names;      // -times: number to name each list entry by, NULL = frame number
+} FrameSelector;
+
+static int selector_done(const FrameSelector* sel) {
+    return sel->queued >= sel->wanted;
+}
+
+// Index of the first list entry >= frame_number (the list is sorted).
+static int selector_lower_bound(const FrameSelector* sel, int frame_number) {
+    int lo = 0, hi = sel->wanted;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (sel->frames[mid] < frame_number) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int selector_wants(const FrameSelector* sel, int frame_number) {
+    if (frame_number < sel->start_frame || frame_number > sel->end_frame) return 0;
+    if (sel->frames) {
+        int i = selector_lower_bound(sel, frame_number);
+        return i < sel->wanted && sel->frames[i] == frame_number;
+    }
+    return (frame_number - sel->start_frame) % sel->step == 0;
+}
+
+// Number of list entries for frame_number (several -times requests can land
+// on one frame); *first is the first of them.
+static int selector_entries(const FrameSelector* sel, int frame_number, int* first) {
+    *first = 0;
+    if (!sel->frames) return selector_wants(sel, frame_number);
+    if (frame_number < sel->start_frame || frame_number > sel->end_frame) return 0;
+    int i = selector_lower_bound(sel, frame_number);
+    *first = i;
+    int n = 0;
+    while (i + n < sel->wanted && sel->frames[i + n] == frame_number) n++;
+    return n;
+}
+
+// Name number for list entry i of frame_number.
+static int selector_name(const FrameSelector* sel, int i, int frame_number) {
+    return sel->names ? sel->names[i] : frame_number;
+}
+
+// First wanted frame at or after frame_number, or -1.
+static int selector_next(const FrameSelector* sel, int frame_number) {
+    if (frame_number < sel->start_frame) frame_number = sel->start_frame;
+    if (frame_number > sel->end_frame) return -1;
+    if (!sel->frames) {
+        int offset = (frame_number - sel->start_frame) % sel->step;
+        int next = offset ? frame_number + sel->step - offset : frame_number;
+        return next <= sel->end_frame ? next : -1;
+    }
+    int i = selector_lower_bound(sel, frame_number);
+    return i < sel->wanted ? sel->frames[i] : -1;
+}
+
+static void selector_offer(FrameSelector* sel, AVFrame* frame, int frame_number) {
+    int first;
+    int entries = selector_entries(sel, frame_number, &first);
+    if (!entries) return;
+
+    int stage = alloc_stage;
+    ALLOC_STAGE(ALLOC_STAGE_QUEUE);
+    for (int i = first; i < first + entries; i++) {
+        queue_push(sel->queue, frame, selector_name(sel, i, frame_number));
+    }
+    ALLOC_STAGE(stage);
+    sel->queued += entries;
+
+    if (sel->queued % 10 == 0) {
+        printf("\r📽️ Decoded: %d/%d frames", sel->queued, sel->wanted);
+        fflush(stdout);
+    }
+}
+
+// ==================== FILTER GRAPH ====================
+
+// In-process libavfilter graph between the decoder and the frame queue, so
+// pre-processing (-vf) shares the single decode.
+typedef struct {
+    AVFilterGraph* graph;
+    AVFilterContext* src;
+    AVFilterContext* sink;
+    AVRational time_base;     // of the filtered frames
+    AVRational frame_rate;    // of the filtered frames, 0/1 if variable
+    int64_t pts_origin;       // filtered PTS of frame 0
+    int next_number;
+} FilterPipeline;
+
+void filter_pipeline_free(FilterPipeline* fp) {
+    avfilter_graph_free(&fp->graph);
+    memset(fp, 0, sizeof(FilterPipeline));
+}
+
+int filter_pipeline_init(FilterPipeline* fp, const char* desc, const AVStream* st) {
+    const AVCodecParameters* par = st->codecpar;
+    memset(fp, 0, sizeof(FilterPipeline));
+
+    fp->graph = avfilter_graph_alloc();
+    AVFilterInOut* outputs = avfilter_inout_alloc();
+    AVFilterInOut* inputs = avfilter_inout_alloc();
+    if (!fp->graph || !outputs || !inputs) goto fail;
+
+    // Slice threading inside filters (scale, yadif, eq...) on every core
+    fp->graph->nb_threads = cpu_count();
+
+    AVRational sar = par->sample_aspect_ratio.num ? par->sample_aspect_ratio : (AVRational){0, 1};
+    AVRational rate = st->avg_frame_rate.num ? st->avg_frame_rate : st->r_frame_rate;
+    char args[512];
+    snprintf(args, sizeof(args),
+             "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+             par->width, par->height, par->format,
+             st->time_base.num, st->time_base.den, sar.num, sar.den);
+    if (rate.num > 0 && rate.den > 0) {
+        size_t len = strlen(args);
+        snprintf(args + len, sizeof(args) - len, ":frame_rate=%d/%d", rate.num, rate.den);
+    }
+
+    if (avfilter_graph_create_filter(&fp->src, avfilter_get_by_name("buffer"), "in",
+                                     args, NULL, fp->graph) < 0) goto fail;
+    if (avfilter_graph_create_filter(&fp->sink, avfilter_get_by_name("buffersink"), "out",
+                                     NULL, NULL, fp->graph) < 0) goto fail;
+
+    outputs->name = av_strdup("in");
+    outputs->filter_ctx = fp->src;
+    outputs->pad_idx = 0;
+    outputs->next = NULL;
+
+    inputs->name = av_strdup("out");
+    inputs->filter_ctx = fp->sink;
+    inputs->pad_idx = 0;
+    inputs->next = NULL;
+
+    if (avfilter_graph_parse_ptr(fp->graph, desc, &inputs, &outputs, NULL) < 0) goto fail;
+    if (avfilter_graph_config(fp->graph, NULL) < 0) goto fail;
+
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+
+    fp->time_base = av_buffersink_get_time_base(fp->sink);
+    fp->frame_rate = av_buffersink_get_frame_rate(fp->sink);
+    fp->pts_origin = av_rescale_q(st->start_time != AV_NOPTS_VALUE ? st->start_time : 0,
+                                  st->time_base, fp->time_base);
+    return 1;
+
+fail:
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+    filter_pipeline_free(fp);
+    return 0;
+}
+
+// Pulls everything the graph has ready. Selection and naming use the
+// filtered PTS, so e.g. "fps=1" numbers its output seconds 0, 1, 2...
+void filter_drain(FilterPipeline* fp, AVFrame* out, FrameSelector* sel) {
+    while (!selector_done(sel) && av_buffersink_get_frame(fp->sink, out) >= 0) {
+        int number = fp->next_number;
+        if (out->pts != AV_NOPTS_VALUE && fp->frame_rate.num > 0) {
+            number = (int)av_rescale_q(out->pts - fp->pts_origin, fp->time_base,
+                                       av_inv_q(fp->frame_rate));
+        }
+        fp->next_number = number + 1;
+        selector_offer(sel, out, number);
+        av_frame_unref(out);
+    }
+}
+
+// ==================== INTRA-ONLY PARALLEL DECODE ====================
+
+// ProRes, DNxHD, FFV1 intra, MJPEG... every packet decodes on its own, so
+// instead of one sequential decoder the demuxer hands the wanted packets to
+// a pool of independent decoder contexts, which feed the usual frame queue.
+// The codec property alone is not enough: FFV1 with a GOP (-g > 1) keeps
+// coder state across non-keyframes, so every packet must also be a keyframe.
+
+#define INTRA_SEEK_GAP 16   // skip ahead by seeking when the next wanted frame is this far
+
+int codec_is_intra_only(const AVCodecParameters* par) {
+    const AVCodecDescriptor* desc = avcodec_descriptor_get(par->codec_id);
+    return desc && (desc->props & AV_CODEC_PROP_INTRA_ONLY);
+}
+
+static int frame_index_all_keyframes(const FrameIndex* idx) {
+    for (int i = 0; i < idx->count; i++) {
+        if (!idx->entries[i].keyframe) return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    AVPacket* packets[MAX_QUEUE_SIZE];
+    int frame_numbers[MAX_QUEUE_SIZE];
+    int head;
+    int tail;
+    int count;
+    int done;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_full;
+    pthread_cond_t not_empty;
+} PacketQueue;
+
+static void packet_queue_init(PacketQueue* q) {
+    memset(q, 0, sizeof(PacketQueue));
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+}
+
+static void packet_queue_destroy(PacketQueue* q) {
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+}
+
+// Takes a new reference to pkt.
+static void packet_queue_push(PacketQueue* q, const AVPacket* pkt, int frame_number) {
+    pthread_mutex_lock(&q->mutex);
+    while (q->count >= MAX_QUEUE_SIZE) {
+        pthread_cond_wait(&q->not_full, &q->mutex);
+    }
+    q->packets[q->head] = av_packet_clone(pkt);
+    q->frame_numbers[q->head] = frame_number;
+    q->head = (q->head + 1) % MAX_QUEUE_SIZE;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+static int packet_queue_pop(PacketQueue* q, AVPacket** pkt, int* frame_number) {
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == 0 && !q->done) {
+        pthread_cond_wait(&q->not_empty, &q->mutex);
+    }
+    if (q->count == 0) {
+        pthread_mutex_unlock(&q->mutex);
+        return 0;
+    }
+    *pkt = q->packets[q->tail];
+    *frame_number = q->frame_numbers[q->tail];
+    q->tail = (q->tail + 1) % MAX_QUEUE_SIZE;
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+    return 1;
+}
+
+static void packet_queue_set_done(PacketQueue* q) {
+    pthread_mutex_lock(&q->mutex);
+    q->done = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+typedef struct {
+    PacketQueue* packets;
+    FrameSelector* sel;
+    const AVCodec* codec;
+    const AVCodecParameters* par;
+    int decoded;
+    int failed;
+} IntraWorkerArgs;
+
+static void* intra_decode_thread(void* arg) {
+    IntraWorkerArgs* args = (IntraWorkerArgs*)arg;
+    AVCodecContext* ctx = avcodec_alloc_context3(args->codec);
+    AVFrame* frame = av_frame_alloc();
+    int ready = ctx && frame && avcodec_parameters_to_context(ctx, args->par) >= 0;
+    if (ready) {
+        ctx->thread_count = 1;   // the pool is the parallelism
+        ready = avcodec_open2(ctx, args->codec, NULL) >= 0;
+    }
+
+    AVPacket* pkt;
+    int frame_number;
+    while (packet_queue_pop(args->packets, &pkt, &frame_number)) {
+        ALLOC_STAGE(ALLOC_STAGE_DECODE);
+        int got = 0;
+        if (ready && avcodec_send_packet(ctx, pkt) >= 0) {
+            while (avcodec_receive_frame(ctx, frame) == 0) {
+                ALLOC_STAGE(ALLOC_STAGE_QUEUE);
+                queue_push(args->sel->queue, frame, frame_number);
+                __atomic_fetch_add(&args->sel->queued, 1, __ATOMIC_RELAXED);
+                av_frame_unref(frame);
+                got = 1;
+            }
+        }
+        if (got) args->decoded++;
+        else args->failed++;
+        av_packet_free(&pkt);
+    }
+
+    av_frame_free(&frame);
+    avcodec_free_context(&ctx);
+    return NULL;
+}
+
+// Demuxes the stream and dispatches the selected packets to `workers`
+// decoder threads. Frames are numbered from the index (or the PTS after a
+// seek) exactly as the sequential loop does; with an index, long gaps
+// between wanted frames are skipped by seeking straight to the next one.
+// sel->queued counts frames as the workers queue them, so packets that
+// fail to decode are not reported as extracted.
+// Returns -1 when done, or, on reaching a packet that is not a keyframe,
+// the frame number the sequential decoder has to take over from; the
+// demuxer is then seeked back to the keyframe before it, and frames below
+// that number are no longer selected.
+int decode_intra_parallel(AVFormatContext* fmt_ctx, int stream_idx, const AVCodec* codec,
+                          const FrameIndex* index, FrameSelector* sel, int current_frame,
+                          AVRational frame_duration, int64_t first_pts, int seeked, int workers) {
+    AVStream* st = fmt_ctx->streams[stream_idx];
+    PacketQueue packets;
+    packet_queue_init(&packets);
+
+    pthread_t* tids = (pthread_t*)calloc(workers, sizeof(pthread_t));
+    IntraWorkerArgs* args = (IntraWorkerArgs*)calloc(workers, sizeof(IntraWorkerArgs));
+    for (int i = 0; i < workers; i++) {
+        args[i] = (IntraWorkerArgs){&packets, sel, codec, st->codecpar, 0, 0};
+        pthread_create(&tids[i], NULL, intra_decode_thread, &args[i]);
+    }
+
+    for (int i = 0; i < (int)fmt_ctx->nb_streams; i++) {
+        if (i != stream_idx) fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    AVPacket packet;
+    int dispatched = 0;
+    int resume = -1;
+    ALLOC_STAGE(ALLOC_STAGE_DEMUX);
+    while (dispatched < sel->wanted && av_read_frame(fmt_ctx, &packet) >= 0) {
+        if (packet.stream_index == stream_idx) {
+            int64_t ts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+            if (ts != AV_NOPTS_VALUE && index->count > 0) {
+                int n = frame_index_lookup(index, ts);
+                if (n >= 0) current_frame = n;
+            } else if (ts != AV_NOPTS_VALUE && seeked) {
+                current_frame = (int)av_rescale_q(ts - first_pts, st->time_base, frame_duration);
+                seeked = 0;
+            }
+
+            if (!(packet.flags & AV_PKT_FLAG_KEY)) {
+                resume = current_frame;
+                if (ts != AV_NOPTS_VALUE) {
+                    av_seek_frame(fmt_ctx, stream_idx, ts, AVSEEK_FLAG_BACKWARD);
+                }
+                av_packet_unref(&packet);
+                break;
+            }
+
+            int first;
+            int entries = selector_entries(sel, current_frame, &first);
+            for (int i = first; i < first + entries; i++) {
+                packet_queue_push(&packets, &packet, selector_name(sel, i, current_frame));
+                dispatched++;
+                if (dispatched % 10 == 0) {
+                    printf("\r📽️ Dispatched: %d/%d frames", dispatched, sel->wanted);
+                    fflush(stdout);
+                }
+            }
+            current_frame++;
+
+            // Every frame is a keyframe, so the next wanted one can be
+            // reached directly instead of reading the packets in between.
+            int next = selector_next(sel, current_frame);
+            if (next >= 0 && next - current_frame >= INTRA_SEEK_GAP && next < index->count) {
+                av_seek_frame(fmt_ctx, stream_idx, index->entries[next].pts, AVSEEK_FLAG_BACKWARD);
+                current_frame = next;
+            }
+        }
+        av_packet_unref(&packet);
+    }
+
+    packet_queue_set_done(&packets);
+    int failed = 0;
+    for (int i = 0; i < workers; i++) {
+        pthread_join(tids[i], NULL);
+        failed += args[i].failed;
+    }
+    if (failed > 0) {
+        printf("\n⚠️  %d packets failed to decode\n", failed);
+    }
+    packet_queue_destroy(&packets);
+    free(tids);
+    free(args);
+
+    // The sequential decoder restarts at the keyframe before `resume`;
+    // frames already dispatched must not be selected a second time.
+    if (resume >= 0) {
+        int next = selector_next(sel, resume);
+        sel->start_frame = next >= 0 ? next : sel->end_frame + 1;
+    }
+    ALLOC_STAGE(ALLOC_STAGE_OTHER);
+    return resume;
+}
+
+// ==================== FRAME EXTRACTION ====================
+
+typedef struct {
+    int frames_saved;
+    double elapsed;          // decode start until the last frame is on disk
+    double* latencies;       // per frame, decoded -> saved (seconds); caller frees
+    int latency_count;
+} RunStats;
+
+// Clockwise rotation (0/90/180/270) the stream's display matrix asks for,
+// as phone recordings store portrait video as rotated landscape frames.
+static int stream_rotation(const AVStream* stream) {
+    const int32_t* matrix = NULL;
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(60, 31, 102)
+    const AVPacketSideData* sd = av_packet_side_data_get(stream->codecpar->coded_side_data,
+                                                         stream->codecpar->nb_coded_side_data,
+                                                         AV_PKT_DATA_DISPLAYMATRIX);
+    if (sd && sd->size >= 9 * (int)sizeof(int32_t)) matrix = (const int32_t*)sd->data;
+#else
+    matrix = (const int32_t*)av_stream_get_side_data(stream, AV_PKT_DATA_DISPLAYMATRIX, NULL);
+#endif
+    if (!matrix) return 0;
+
+    // av_display_rotation_get() is counter-clockwise
+    double theta = -av_display_rotation_get(matrix);
+    if (isnan(theta)) return 0;
+    int rotation = (int)lround(theta / 90.0) * 90 % 360;
+    return rotation < 0 ? rotation + 360 : rotation;
+}
+
+// ---- Packet passthrough ----
+// MJPEG and PNG streams already store every frame as a standalone image,
+// so -passthrough writes the packet payload as the output file: no decode,
+// no conversion, no encode.
+
+// Standard Huffman tables (ITU T.81 Annex K.3), as a DHT segment. Many
+// MJPEG streams omit them and rely on the decoder's defaults, which
+// still-image readers don't have.
+static const uint8_t jpeg_std_dht[] = {
+    0xFF, 0xC4, 0x01, 0xA2,
+    0x00, 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+    0x01, 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+    0x10, 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d,
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+    0x11, 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77,
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+// Offset of the SOS marker if the JPEG has no DHT segment before it (the
+// tables must go in there), or 0 if it has its own tables or can't be
+// parsed.
+static size_t jpeg_missing_dht_at(const uint8_t* data, size_t size) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return 0;
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) return 0;
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {   // fill byte
+            pos++;
+            continue;
+        }
+        if (marker == 0xC4) return 0;
+        if (marker == 0xDA) return pos;
+        pos += 2 + ((size_t)data[pos + 2] << 8 | data[pos + 3]);
+    }
+    return 0;
+}
+
+// Name of the single file a saver writes for one frame (see
+// frame_saver_thread), used to serve -frame-cache hits without decoding.
+static void saved_file_name(char* filename, size_t size, int fast_mode, int format) {
+#ifndef HAVE_WEBP
+    (void)format;
+#endif
+    if (fast_mode) {
+        if (!strstr(filename, ".yuv")) strncat(filename, ".yuv", size - strlen(filename) - 1);
+#ifdef HAVE_WEBP
+    } else if (format == FORMAT_WEBP) {
+        set_extension(filename, size, ".webp");
+#endif
+    } else if (!strstr(filename, ".png")) {
+        strncat(filename, ".png", size - strlen(filename) - 1);
+    }
+}
+
+// Output extension when the stream can be passed through as-is, else NULL.
+// Anything that changes pixels (filters, resizing, rotation, non-square
+// pixels, other output formats) needs the decoded frame.
+static const char* passthrough_extension(const Config* config, const AVStream* st) {
+    const AVCodecParameters* par = st->codecpar;
+    AVRational sar = par->sample_aspect_ratio;
+    int square = config->no_sar_correct || sar.num == 0 || sar.num == sar.den;
+    int untouched = config->filter_graph[0] == '\0' && config->deinterlace == DEINTERLACE_NONE &&
+                    config->fit_w == 0 && config->tile_w == 0 && config->pyramid <= 1 &&
+                    config->animate_path[0] == '\0' && !config->fast_mode && square &&
+                    (config->no_autorotate || stream_rotation(st) == 0);
+    // The packets are kept as they are, so any other requested format or
+    // 16-bit output means decoding
+    if (!untouched || config->format != FORMAT_PNG || config->depth == 16) return NULL;
+    if (par->codec_id == AV_CODEC_ID_MJPEG) return ".jpg";
+    if (par->codec_id == AV_CODEC_ID_PNG) return ".png";
+    return NULL;
+}
+
+static int write_passthrough(const char* filename, const AVPacket* pkt, int jpeg) {
+    FILE* fp = fopen(filename, "wb");
+    if (!fp) return 0;
+    size_t sos = jpeg ? jpeg_missing_dht_at(pkt->data, pkt->size) : 0;
+    int ok;
+    if (sos) {
+        ok = fwrite(pkt->data, 1, sos, fp) == sos &&
+             fwrite(jpeg_std_dht, 1, sizeof(jpeg_std_dht), fp) == sizeof(jpeg_std_dht) &&
+             fwrite(pkt->data + sos, 1, pkt->size - sos, fp) == pkt->size - sos;
+    } else {
+        ok = fwrite(pkt->data, 1, pkt->size, fp) == (size_t)pkt->size;
+    }
+    fclose(fp);
+    return ok;
+}
+
+// Demux-only extraction of the selected frames. Intra image codecs have
+// no reordering, so packets arrive in frame order and are numbered the
+// same way the decode loop numbers frames.
+static int extract_passthrough(Config* config, AVFormatContext* fmt_ctx, int stream_idx,
+                               const FrameIndex* index, const char* ext,
+                               const int* frames, const int* names, int frame_count,
+                               int start_frame, int end_frame, int extract_count, RunStats* stats) {
+    AVStream* st = fmt_ctx->streams[stream_idx];
+    AVRational frame_duration = st->avg_frame_rate.num > 0 ? av_inv_q(st->avg_frame_rate)
+                                                           : av_inv_q(st->r_frame_rate);
+    int64_t first_pts = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+    FrameSelector sel = {NULL, frames, start_frame, end_frame, config->step > 0 ? config->step : 1,
+                         frame_count, 0, names};
+    int jpeg = st->codecpar->codec_id == AV_CODEC_ID_MJPEG;
+    int seeked = 0;
+
+    if (start_frame > 0) {
+        av_seek_frame(fmt_ctx, stream_idx, frame_index_seek_pts(index, st, frame_duration, start_frame),
+                      AVSEEK_FLAG_BACKWARD);
+        seeked = 1;
+    }
+
+    // Only the video stream's packets are read
+    for (int i = 0; i < (int)fmt_ctx->nb_streams; i++) {
+        if (i != stream_idx) fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    ProgressTracker progress;
+    progress_init(&progress, extract_count);
+    printf("\n⚡ Passthrough: writing %s packets as %s files (no decoding)\n",
+           avcodec_get_name(st->codecpar->codec_id), ext);
+
+    pthread_t audio_thread;
+    if (config->extract_audio) {
+        pthread_create(&audio_thread, NULL, extract_audio_thread, config);
+    }
+
+    Timer clock;
+    timer_start(&clock);
+    AVPacket packet;
+    int current_frame = 0;
+    int written = 0;
+    int done = 0;
+
+    while (!done && av_read_frame(fmt_ctx, &packet) >= 0) {
+        if (packet.stream_index == stream_idx) {
+            int64_t ts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+            if (ts != AV_NOPTS_VALUE && index->count > 0) {
+                int n = frame_index_lookup(index, ts);
+                if (n >= 0) current_frame = n;
+            } else if (ts != AV_NOPTS_VALUE && seeked) {
+                current_frame = (int)av_rescale_q(ts - first_pts, st->time_base, frame_duration);
+                seeked = 0;
+            }
+
+            int first;
+            int entries = selector_entries(&sel, current_frame, &first);
+            for (int i = first; i < first + entries; i++) {
+                char filename[512];
+                format_output_name(filename, sizeof(filename), config->output_pattern,
+                                   selector_name(&sel, i, current_frame), ts, st->time_base, first_pts);
+                set_extension(filename, sizeof(filename), ext);
+                if (write_passthrough(filename, &packet, jpeg)) {
+                    written++;
+                    progress_file_done(&progress, selector_name(&sel, i, current_frame), filename);
+                }
+                progress_update(&progress, 1, 0);
+            }
+            done = written >= extract_count || current_frame >= end_frame;
+            current_frame++;
+
+            // Every packet is a keyframe: jump straight to the next segment
+            int next = selector_next(&sel, current_frame);
+            if (!done && next - current_frame >= INTRA_SEEK_GAP && next < index->count) {
+                av_seek_frame(fmt_ctx, stream_idx, index->entries[next].pts, AVSEEK_FLAG_BACKWARD);
+                current_frame = next;
+            }
+        }
+        av_packet_unref(&packet);
+    }
+
+    if (config->extract_audio) {
+        pthread_join(audio_thread, NULL);
+    }
+
+    progress_finish(&progress);
+    if (stats) {
+        stats->frames_saved = written;
+        stats->elapsed = timer_elapsed(clock);
+    }
+    printf("\n✅ Done! Wrote %d frames without decoding\n", written);
+    return written > 0 ? 0 : 1;
+}
+
+// Copies the per-frame output options into the queue the savers read.
+static void queue_apply_config(FrameQueue* q, const Config* config, const AVStream* st) {
+    q->png_level = config->png_level;
+    q->depth = config->depth == 16 ? 16 : 8;
+    q->tonemap = config->tonemap;
+    q->rotation = config->no_autorotate ? 0 : stream_rotation(st);
+    q->correct_sar = !config->no_sar_correct;
+    q->deinterlace = config->deinterlace;
+    q->pyramid = config->pyramid;
+    q->tile_w = config->tile_w;
+    q->tile_h = config->tile_h;
+    q->tile_overlap = config->tile_overlap;
+    q->tile_batch = config->tile_batch;
+    q->tile_min_variance = config->tile_min_variance;
+    q->fit_w = config->fit_w;
+    q->fit_h = config->fit_h;
+    q->fit_mode = config->fit_mode;
+    memcpy(q->pad_color, config->pad_color, sizeof(q->pad_color));
+    q->quality = config->quality;
+    q->webp_method = config->webp_method;
+    q->lossless = config->lossless;
+    q->png_threads = config->png_threads;
+    if (q->format == FORMAT_WEBP) {
+        q->depth = 8;   // WebP has no 16-bit mode
+    }
+}
+
+// Runs one extraction as configured. stats may be NULL. Returns the process
+// exit code.
+int extract_frames(Config* config, RunStats* stats) {
+#ifdef HAVE_WEBP
+    // Checked once up front: a saver that cannot encode would otherwise
+    // leave the decoder blocked on a full queue
+    if (config->format == FORMAT_WEBP && !config->fast_mode) {
+        WebpEncoder probe;
+        memset(&probe, 0, sizeof(WebpEncoder));
+        int valid = webp_encoder_init(&probe, config->quality, config->webp_method, config->lossless);
+        webp_encoder_free(&probe);
+        if (!valid) {
+            printf("❌ Invalid WebP settings (-quality %d, -webp-method %d)\n",
+                   config->quality, config->webp_method);
+            return 1;
+        }
+    }
+#endif
+    // Everything released on the way out, declared here so every failure
+    // can leave through `cleanup` (-perfcheck calls this repeatedly)
+    int rc = 1;
+    AVFormatContext* fmt_ctx = NULL;
+    FrameIndex index;
+    FilterPipeline filter;
+    FrameCache cache;
+    int use_cache = 0;
+    int* frames_to_extract = NULL;
+    int* name_list = NULL;     // -times: request position of each list entry
+    AVCodecContext* codec_ctx = NULL;
+    AVFrame* frame = NULL;
+    AVFrame* filtered = NULL;
+    memset(&index, 0, sizeof(FrameIndex));
+    memset(&filter, 0, sizeof(FilterPipeline));
+
+    avformat_network_init();
+    fmt_ctx = avformat_alloc_context();
+
+    printf("📂 Opening: %s\n", config->input);
+    if (avformat_open_input(&fmt_ctx, config->input, NULL, NULL) != 0) {
+        printf("❌ Error: Cannot open file!\n");
+        goto cleanup;
+    }
+
+    avformat_find_stream_info(fmt_ctx, NULL);
+
+    int video_stream_idx = -1;
+
+    printf("\n🔍 Scanning streams:\n");
+    for (int i = 0; i < fmt_ctx->nb_streams; i++) {
+        AVStream* stream = fmt_ctx->streams[i];
+        const char* type = "unknown";
+
+        if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            type = "VIDEO";
+            video_stream_idx = i;
+        } else if (stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+            type = "AUDIO";
+        }
+
+        printf("   Stream %d: %s\n", i, type);
+    }
+
+    if (video_stream_idx == -1) {
+        printf("❌ No video stream found!\n");
+        goto cleanup;
+    }
+
+    AVStream* video_stream = fmt_ctx->streams[video_stream_idx];
+    double fps = av_q2d(video_stream->avg_frame_rate);
+    int total_frames = video_stream->nb_frames;
+    int width = video_stream->codecpar->width;
+    int height = video_stream->codecpar->height;
+
+    printf("\n📹 Video: stream %d, %dx%d, %.2f fps, %d frames\n", 
+           video_stream_idx, width, height, fps, total_frames);
+
+    // ===== EXACT FRAME INDEX =====
+    // Free for MP4/MOV; elsewhere (and for a MOV table that fails the PTS
+    // check) only paid for when the header has no count or -exact-count /
+    // -times / -frame-cache needs the PTS, since it reads the whole file.
+    // Otherwise the header count and estimated seeks are used as before.
+    int container = frame_index_from_container(&index, fmt_ctx, video_stream_idx);
+    int want_scan = total_frames <= 0 || config->exact_count || config->times_count > 0 ||
+                    config->frame_cache[0];
+    if (container > 0 || (want_scan && frame_index_scan_packets(&index, config->input, video_stream_idx))) {
+        if (index.count != total_frames) {
+            printf("📇 Frame index (%s): %d frames%s\n",
+                   index.from_container ? "sample tables" : "packet scan", index.count,
+                   total_frames > 0 ? " (header disagrees)" : "");
+        }
+        total_frames = index.count;
+    }
+
+    // ===== FILTER GRAPH =====
+    // With -vf, frame numbers refer to the filter's output, so the count and
+    // rate used for clamping and -time lookups follow the output rate.
+    // -deinterlace bwdif is prepended to the user's graph; deint=interlaced
+    // passes progressive frames straight through.
+    char graph_desc[1100];
+    snprintf(graph_desc, sizeof(graph_desc), "%s%s%s",
+             config->deinterlace == DEINTERLACE_BWDIF ? "bwdif=mode=send_frame:deint=interlaced" : "",
+             config->deinterlace == DEINTERLACE_BWDIF && config->filter_graph[0] ? "," : "",
+             config->filter_graph);
+
+    if (graph_desc[0] != '\0') {
+        if (!filter_pipeline_init(&filter, graph_desc, video_stream)) {
+            printf("❌ Invalid filter graph: %s\n", graph_desc);
+            goto cleanup;
+        }
+        printf("🧪 Filter graph: %s (%d threads)\n", graph_desc, filter.graph->nb_threads);
+
+        double out_fps = filter.frame_rate.num > 0 ? av_q2d(filter.frame_rate) : fps;
+        if (total_frames > 0 && fps > 0 && out_fps != fps) {
+            total_frames = (int)ceil(total_frames * out_fps / fps);
+        }
+        fps = out_fps;
+        frame_index_free(&index);
+    }
+
+    // ===== FIX FOR VIDEOS WITH NO FRAME COUNT =====
+    if (total_frames <= 0) {
+        printf("\n⚠️  Warning: Video has no frame count in header\n");
+
+        double duration = 0;
+        if (fmt_ctx->duration > 0) {
+            duration = fmt_ctx->duration / (double)AV_TIME_BASE;
+        }
+        if (duration <= 0 && video_stream->duration > 0) {
+            duration = video_stream->duration * av_q2d(video_stream->time_base);
+        }
+
+        if (duration > 0) {
+            double exact_frames = duration * fps;
+            total_frames = (int)ceil(exact_frames);
+            printf("   Duration: %.3f seconds\n", duration);
+            printf("   Calculated frames: %.3f → %d frames\n", exact_frames, total_frames);
+        } else {
+            printf("❌ Cannot determine video duration!\n");
+            goto cleanup;
+        }
+    }
+
+    int start_frame = 0, end_frame = total_frames - 1;
+    const int multi_segment = config->segment_count > 1 && config->times_count == 0;
+    int spans[MAX_RANGE_SEGMENTS][2];
+    int* time_frames = NULL;
+
+    if (config->times_count > 0) {
+        // -times: each request becomes a list entry named by its position.
+        // Sorting by frame puts requests sharing a GOP next to each other,
+        // so the decode loop handles a GOP once and seeks to the next.
+        int n = config->times_count;
+        int64_t* keyed = (int64_t*)malloc(n * sizeof(int64_t));
+        int* frames = (int*)malloc(n * sizeof(int));
+        name_list = (int*)malloc(n * sizeof(int));
+        for (int i = 0; i < n; i++) {
+            int f = frame_index_resolve_time(&index, config->times[i], video_stream->time_base,
+                                             fps, config->snap_nearest);
+            f = FFMIN(FFMAX(f, 0), total_frames - 1);
+            keyed[i] = ((int64_t)f << 32) | (uint32_t)i;
+        }
+        qsort(keyed, n, sizeof(int64_t), compare_int64);
+        int batches = 0, last_gop = -1;
+        for (int i = 0; i < n; i++) {
+            frames[i] = (int)(keyed[i] >> 32);
+            name_list[i] = (int)(keyed[i] & 0xffffffff);
+            int gop = frame_index_gop_start(&index, frames[i]);
+            if (gop >= 0 && gop != last_gop) batches++;
+            last_gop = gop;
+        }
+        free(keyed);
+        time_frames = frames;
+        start_frame = frames[0];
+        end_frame = frames[n - 1];
+        printf("\n⏱️ %d timestamps → frames %d to %d (%s frame)\n", n, start_frame, end_frame,
+               config->snap_nearest ? "nearest" : "preceding");
+        if (batches > 0) printf("   %d GOP batches\n", batches);
+    } else if (multi_segment) {
+        // Several -range/-time-range segments: one sorted frame list, so the
+        // decode loop visits them in order and seeks across the gaps.
+        start_frame = total_frames - 1;
+        end_frame = 0;
+        printf("\n📹 %d segments:\n", config->segment_count);
+        for (int i = 0; i < config->segment_count; i++) {
+            const RangeSegment* seg = &config->segments[i];
+            int s, e;
+            if (seg->is_time) {
+                s = index.count > 0
+                    ? frame_index_time_to_frame(&index, parse_time_seconds(seg->start_time), video_stream->time_base)
+                    : parse_time_to_frame(seg->start_time, fps);
+                e = index.count > 0
+                    ? frame_index_time_to_frame(&index, parse_time_seconds(seg->end_time), video_stream->time_base)
+                    : parse_time_to_frame(seg->end_time, fps);
+                printf("   %s to %s = frames %d to %d\n", seg->start_time, seg->end_time, s, e);
+            } else {
+                s = seg->start_frame;
+                e = seg->end_frame > 0 ? seg->end_frame : total_frames - 1;
+                printf("   frames %d to %d\n", s, e);
+            }
+            spans[i][0] = FFMAX(s, 0);
+            spans[i][1] = FFMIN(e, total_frames - 1);
+            start_frame = FFMIN(start_frame, spans[i][0]);
+            end_frame = FFMAX(end_frame, spans[i][1]);
+        }
+    } else if (config->use_time) {
+        start_frame = index.count > 0
+            ? frame_index_time_to_frame(&index, parse_time_seconds(config->time_str), video_stream->time_base)
+            : parse_time_to_frame(config->time_str, fps);
+        end_frame = start_frame;
+        printf("\n⏱️ Time %s = frame %d\n", config->time_str, start_frame);
+    } else if (config->use_time_range) {
+        if (index.count > 0) {
+            start_frame = frame_index_time_to_frame(&index, parse_time_seconds(config->start_time),
+                                                    video_stream->time_base);
+            end_frame = frame_index_time_to_frame(&index, parse_time_seconds(config->end_time),
+                                                  video_stream->time_base);
+        } else {
+            start_frame = parse_time_to_frame(config->start_time, fps);
+            end_frame = parse_time_to_frame(config->end_time, fps);
+        }
+        printf("\n⏱️ Time range %s to %s = frames %d to %d\n", 
+               config->start_time, config->end_time, start_frame, end_frame);
+    } else if (config->start_frame > 0 || config->end_frame > 0) {
+        if (config->start_frame > 0) start_frame = config->start_frame;
+        if (config->end_frame > 0) end_frame = config->end_frame;
+        printf("\n📹 Frame range: %d to %d\n", start_frame, end_frame);
+    }
+
+    if (start_frame < 0) start_frame = 0;
+    if (end_frame >= total_frames) end_frame = total_frames - 1;
+
+    int max_extract = config->frame_count > 0 ? config->frame_count : end_frame - start_frame + 1;
+    if (time_frames) max_extract = config->times_count;
+    if (multi_segment && config->frame_count == 0) {
+        max_extract = 0;
+        for (int i = 0; i < config->segment_count; i++) {
+            if (spans[i][1] >= spans[i][0]) max_extract += (spans[i][1] - spans[i][0]) / config->step + 1;
+        }
+    }
+    frames_to_extract = (int*)malloc((max_extract > 0 ? max_extract : 1) * sizeof(int));
+    int extract_count = 0;
+
+    if (time_frames) {
+        memcpy(frames_to_extract, time_frames, config->times_count * sizeof(int));
+        extract_count = config->times_count;
+        free(time_frames);
+        printf("📋 Extracting %d frames, named in request order\n", extract_count);
+    } else if (config->frame_count > 0) {
+        for (int i = 0; i < config->frame_count; i++) {
+            int f = config->frames[i];
+            int wanted = f >= start_frame && f <= end_frame;
+            if (wanted && multi_segment) {
+                wanted = 0;
+                for (int k = 0; k < config->segment_count && !wanted; k++) {
+                    wanted = f >= spans[k][0] && f <= spans[k][1];
+                }
+            }
+            if (wanted) frames_to_extract[extract_count++] = f;
+        }
+        printf("📋 Extracting %d specific frames\n", extract_count);
+    } else if (multi_segment) {
+        for (int i = 0; i < config->segment_count; i++) {
+            for (int f = spans[i][0]; f <= spans[i][1]; f += config->step) {
+                frames_to_extract[extract_count++] = f;
+            }
+        }
+        printf("📋 Extracting frames from %d segments (step %d)\n", config->segment_count, config->step);
+    } else {
+        for (int f = start_frame; f <= end_frame; f += config->step) {
+            frames_to_extract[extract_count++] = f;
+        }
+        printf("📋 Extracting %d frames (range %d-%d, step %d)\n", 
+               extract_count, start_frame, end_frame, config->step);
+    }
+
+    // Explicit lists are searched by bisection; overlapping segments or a
+    // repeated -frames entry would otherwise be waited for twice.
+    const int* frame_list = name_list ? frames_to_extract : NULL;
+    if (!name_list && (config->frame_count > 0 || multi_segment)) {
+        qsort(frames_to_extract, extract_count, sizeof(int), compare_ints);
+        int unique = 0;
+        for (int i = 0; i < extract_count; i++) {
+            if (unique == 0 || frames_to_extract[unique - 1] != frames_to_extract[i]) {
+                frames_to_extract[unique++] = frames_to_extract[i];
+            }
+        }
+        extract_count = unique;
+        frame_list = frames_to_extract;
+        if (multi_segment) printf("📋 %d unique frames in one pass\n", extract_count);
+    }
+
+    if (extract_count == 0) {
+        printf("❌ No frames to extract!\n");
+        goto cleanup;
+    }
+
+    // ===== FRAME CACHE =====
+    // Consulted before anything is decoded: hits are copied out and dropped
+    // from the list, so the seek plan below only covers the misses.
+    if (config->frame_cache[0]) {
+        if (index.count == 0 || config->passthrough || config->animate_path[0] ||
+            config->tile_w > 0 || config->pyramid > 1) {
+            printf("⚠️  -frame-cache needs the frame index and one file per frame, not caching\n");
+        } else if (config->filter_graph[0] || config->deinterlace == DEINTERLACE_BWDIF) {
+            // Filter output is neither keyed by the spec nor timed in the
+            // stream time base the index (and so the cache key) uses
+            printf("⚠️  -frame-cache does not apply to filtered output (-vf, -deinterlace bwdif), not caching\n");
+        } else {
+            char spec[512];
+            snprintf(spec, sizeof(spec),
+                     "v1 fmt=%d fast=%d depth=%d level=%d tonemap=%d rot=%d sar=%d deint=%d "
+                     "fit=%dx%d/%d pad=%02x%02x%02x q=%d m=%d lossless=%d",
+                     config->format, config->fast_mode, config->depth == 16 ? 16 : 8, config->png_level,
+                     config->tonemap, config->no_autorotate ? 0 : stream_rotation(video_stream),
+                     !config->no_sar_correct, config->deinterlace, config->fit_w, config->fit_h,
+                     config->fit_mode, config->pad_color[0], config->pad_color[1], config->pad_color[2],
+                     config->quality, config->webp_method, config->lossless);
+            use_cache = frame_cache_open(&cache, config->frame_cache, config->cache_size_gb,
+                                         config->input, spec);
+        }
+    }
+    if (use_cache) {
+        int64_t origin = video_stream->start_time != AV_NOPTS_VALUE ? video_stream->start_time : 0;
+        // Hits are reported to -progress-json like saved files
+        ProgressTracker cache_progress;
+        progress_init(&cache_progress, extract_count);
+        int kept = 0;
+        for (int i = 0; i < extract_count; i++) {
+            int f = frames_to_extract[i];
+            int number = name_list ? name_list[i] : f;
+            char filename[512];
+            format_output_name(filename, sizeof(filename), config->output_pattern, number,
+                               index.entries[f].pts, video_stream->time_base, origin);
+            saved_file_name(filename, sizeof(filename), config->fast_mode, config->format);
+            if (frame_cache_fetch(&cache, index.entries[f].pts, filename)) {
+                progress_file_done(&cache_progress, number, filename);
+            } else {
+                frames_to_extract[kept] = f;
+                if (name_list) name_list[kept] = number;
+                kept++;
+            }
+        }
+
+        if (cache.hits > 0) {
+            printf("🗄️  Frame cache: %d of %d frames served from %s\n", cache.hits, extract_count,
+                   config->frame_cache);
+            extract_count = kept;
+            if (kept == 0) {
+                if (config->extract_audio) {
+                    extract_audio_thread(config);
+                }
+                if (progress_json) {
+                    double elapsed = timer_elapsed(cache_progress.start_time);
+                    progress_json_line(&cache_progress, "done", cache.hits, elapsed,
+                                       elapsed > 0.001 ? cache.hits / elapsed : 0, 0);
+                }
+                if (stats) {
+                    stats->frames_saved = cache.hits;
+                    stats->elapsed = 0;
+                }
+                printf("\n✅ Done! All %d frames came from the cache\n", cache.hits);
+                rc = 0;
+                goto cleanup;
+            }
+            frame_list = frames_to_extract;
+            start_frame = frames_to_extract[0];
+            end_frame = frames_to_extract[kept - 1];
+        }
+    }
+
+    // ===== PACKET PASSTHROUGH =====
+    if (config->passthrough) {
+        const char* ext = passthrough_extension(config, video_stream);
+        if (ext) {
+            rc = extract_passthrough(config, fmt_ctx, video_stream_idx, &index, ext,
+                                     frame_list, name_list, extract_count,
+                                     start_frame, end_frame, extract_count, stats);
+            goto cleanup;
+        }
+        printf("⚠️  Passthrough needs an untouched MJPEG/PNG stream, decoding instead\n");
+    }
+
+    const AVCodec* codec = select_decoder(config, video_stream_idx, video_stream->codecpar);
+    if (!codec) {
+        goto cleanup;
+    }
+    codec_ctx = avcodec_alloc_context3(codec);
+    if (!codec_ctx || avcodec_parameters_to_context(codec_ctx, video_stream->codecpar) < 0 ||
+        avcodec_open2(codec_ctx, codec, NULL) < 0) {
+        printf("❌ Failed to open video codec\n");
+        goto cleanup;
+    }
+
+    frame = av_frame_alloc();
+
+    AVRational frame_duration = video_stream->avg_frame_rate.num > 0
+        ? av_inv_q(video_stream->avg_frame_rate)
+        : av_inv_q(video_stream->r_frame_rate);
+    int64_t first_pts = video_stream->start_time != AV_NOPTS_VALUE ? video_stream->start_time : 0;
+    int seeked = 0;
+
+    if (filter.graph && filter.frame_rate.num > 0) {
+        frame_duration = av_inv_q(filter.frame_rate);
+    }
+
+    if (start_frame > 0) {
+        av_seek_frame(fmt_ctx, video_stream_idx,
+                      frame_index_seek_pts(&index, video_stream, frame_duration, start_frame),
+                      AVSEEK_FLAG_BACKWARD);
+        seeked = 1;
+    }
+
+    FrameQueue frame_queue;
+    queue_init(&frame_queue, width, height, config->format, config->fast_mode, 
+               config->output_pattern, extract_count);
+    queue_apply_config(&frame_queue, config, video_stream);
+    frame_queue.time_base = filter.graph ? filter.time_base : video_stream->time_base;
+    frame_queue.pts_origin = filter.graph ? filter.pts_origin : first_pts;
+    // Entries are keyed by stream PTS, which filtered frames no longer carry
+    frame_queue.cache = use_cache && !filter.graph ? &cache : NULL;
+
+    // -animate: one consumer feeding the GIF/WebP encoder. -scale is a
+    // stretch fit to the display aspect, so scaling happens in the same
+    // sws_scale as the RGB conversion.
+    const int animate = config->animate_path[0] != '\0';
+    if (animate) {
+        frame_queue.depth = 8;
+        frame_queue.tile_w = 0;
+        frame_queue.pyramid = 0;
+        if (config->animate_scale > 0 && frame_queue.fit_w == 0) {
+            int w = filter.graph ? av_buffersink_get_w(filter.sink) : width;
+            int h = filter.graph ? av_buffersink_get_h(filter.sink) : height;
+            AVRational sar = filter.graph ? av_buffersink_get_sample_aspect_ratio(filter.sink)
+                                          : video_stream->codecpar->sample_aspect_ratio;
+            int dw = frame_queue.correct_sar ? display_width(w, sar) : w;
+            if (frame_queue.rotation == 90 || frame_queue.rotation == 270) {
+                int t = dw;
+                dw = h;
+                h = t;
+            }
+            frame_queue.fit_w = config->animate_scale;
+            frame_queue.fit_h = FFMAX(2, (int)lround((double)config->animate_scale * h / dw) & ~1);
+            frame_queue.fit_mode = FIT_STRETCH;
+        }
+    }
+    if (frame_queue.rotation && !config->fast_mode) {
+        printf("🔄 Rotating %d° (display matrix)\n", frame_queue.rotation);
+    }
+    if (stats) {
+        frame_queue.latencies = (double*)malloc(extract_count * sizeof(double));
+    }
+
+    FrameSelector selector;
+    memset(&selector, 0, sizeof(FrameSelector));
+    selector.queue = &frame_queue;
+    selector.frames = frame_list;
+    selector.names = name_list;
+    selector.start_frame = start_frame;
+    selector.end_frame = end_frame;
+    selector.step = config->step > 0 ? config->step : 1;
+    selector.wanted = extract_count;
+
+    ProgressTracker progress;
+    progress_init(&progress, extract_count);
+    progress.decoded = &selector.queued;
+    progress.queue_depth = &frame_queue.count;
+
+    pthread_t saver_threads[NUM_SAVER_THREADS];
+    SaverThreadArgs thread_args[NUM_SAVER_THREADS];
+    const int saver_count = animate ? 0 : NUM_SAVER_THREADS;
+
+    for (int i = 0; i < saver_count; i++) {
+        thread_args[i].queue = &frame_queue;
+        thread_args[i].progress = &progress;
+        pthread_create(&saver_threads[i], NULL, frame_saver_thread, &thread_args[i]);
+    }
+
+    pthread_t anim_thread;
+    AnimateArgs anim_args = {&frame_queue, &progress, config->animate_path,
+                             fps > 0 ? fps : 25.0, config->animate_fps, 0};
+    if (animate) {
+        pthread_create(&anim_thread, NULL, animate_thread, &anim_args);
+    }
+
+    pthread_t audio_thread;
+    if (config->extract_audio) {
+        pthread_create(&audio_thread, NULL, extract_audio_thread, config);
+    }
+
+    if (animate) {
+        printf("\n🎞️  Encoding %s while decoding...\n", config->animate_path);
+    } else {
+        printf("\n🔄 Decoding frames with %d saver threads...\n", NUM_SAVER_THREADS);
+    }
+    timer_start(&frame_queue.clock);
+
+    if (config->profile_alloc) {
+        alloc_profile_start();
+    }
+
+    AVPacket packet;
+    filtered = filter.graph ? av_frame_alloc() : NULL;
+    int current_frame = 0;
+    int eof = 0;
+
+    // Intra-only streams skip the sequential loop below. A filter graph or
+    // an animation needs frames in order, so those keep the single decoder.
+    if (codec_is_intra_only(video_stream->codecpar) && frame_index_all_keyframes(&index) &&
+        !filter.graph && !animate) {
+        int workers = FFMAX(2, cpu_count());
+        printf("🧩 Intra-only %s: decoding packets on %d independent decoders\n",
+               codec->name, workers);
+        int resume = decode_intra_parallel(fmt_ctx, video_stream_idx, codec, &index, &selector,
+                                           current_frame, frame_duration, first_pts, seeked, workers);
+        if (resume < 0) {
+            eof = 1;
+        } else {
+            printf("\n⚠️  Frame %d is not a keyframe, continuing with the sequential decoder\n", resume);
+            avcodec_flush_buffers(codec_ctx);
+            seeked = 1;
+        }
+    }
+
+    ALLOC_STAGE(ALLOC_STAGE_DEMUX);
+    while (!eof && !selector_done(&selector)) {
+        if (av_read_frame(fmt_ctx, &packet) < 0) {
+            // Drain the frames still held back by the decoder
+            eof = 1;
+            ALLOC_STAGE(ALLOC_STAGE_DECODE);
+            avcodec_send_packet(codec_ctx, NULL);
+        } else if (packet.stream_index == video_stream_idx) {
+            ALLOC_STAGE(ALLOC_STAGE_DECODE);
+            avcodec_send_packet(codec_ctx, &packet);
+        }
+
+        if (eof || packet.stream_index == video_stream_idx) {
+            while (!selector_done(&selector) && avcodec_receive_frame(codec_ctx, frame) == 0) {
+                if (filter.graph) {
+                    ALLOC_STAGE(ALLOC_STAGE_FILTER);
+                    av_buffersrc_add_frame_flags(filter.src, frame, AV_BUFFERSRC_FLAG_KEEP_REF);
+                    filter_drain(&filter, filtered, &selector);
+                    ALLOC_STAGE(ALLOC_STAGE_DECODE);
+                    continue;
+                }
+
+                // Number frames by their position in the PTS table; without
+                // one, re-anchor from the PTS once after a seek.
+                int64_t ts = frame->best_effort_timestamp;
+                if (ts != AV_NOPTS_VALUE && index.count > 0) {
+                    int n = frame_index_lookup(&index, ts);
+                    if (n >= 0) current_frame = n;
+                } else if (ts != AV_NOPTS_VALUE && seeked) {
+                    current_frame = (int)av_rescale_q(ts - first_pts, video_stream->time_base, frame_duration);
+                    seeked = 0;
+                }
+
+                int queued = selector.queued;
+                selector_offer(&selector, frame, current_frame);
+                current_frame++;
+
+                // Past the end of a segment, seek to the next one when a
+                // keyframe lies in between rather than decoding the gap.
+                int next = queued < selector.queued ? selector_next(&selector, current_frame) : -1;
+                if (!eof && next - current_frame >= INTRA_SEEK_GAP &&
+                    frame_index_seek_helps(&index, current_frame, next)) {
+                    av_seek_frame(fmt_ctx, video_stream_idx,
+                                  frame_index_seek_pts(&index, video_stream, frame_duration, next),
+                                  AVSEEK_FLAG_BACKWARD);
+                    avcodec_flush_buffers(codec_ctx);
+                    seeked = 1;
+                    break;
+                }
+            }
+
+            if (eof && filter.graph) {
+                ALLOC_STAGE(ALLOC_STAGE_FILTER);
+                av_buffersrc_add_frame_flags(filter.src, NULL, 0);
+                filter_drain(&filter, filtered, &selector);
+            }
+        }
+        ALLOC_STAGE(ALLOC_STAGE_DEMUX);
+        if (!eof) av_packet_unref(&packet);
+    }
+    ALLOC_STAGE(ALLOC_STAGE_OTHER);
+
+    printf("\r📽️ Decoded: %d/%d frames - done!\n", selector.queued, extract_count);
+
+    queue_set_done(&frame_queue);
+
+    for (int i = 0; i < saver_count; i++) {
+        pthread_join(saver_threads[i], NULL);
+    }
+    if (animate) {
+        pthread_join(anim_thread, NULL);
+    }
+
+    if (config->extract_audio) {
+        pthread_join(audio_thread, NULL);
+    }
+
+    if (config->profile_alloc) {
+        alloc_profile_stop();
+    }
+
+    progress_finish(&progress);
+
+    if (config->profile_alloc) {
+        alloc_profile_report(frame_queue.frames_saved);
+    }
+
+    if (stats) {
+        stats->frames_saved = frame_queue.frames_saved;
+        stats->elapsed = timer_elapsed(frame_queue.clock);
+        stats->latencies = frame_queue.latencies;
+        stats->latency_count = FFMIN(frame_queue.latency_count, extract_count);
+    }
+
+    queue_destroy(&frame_queue);
+
+    if (use_cache) {
+        printf("🗄️  Frame cache: stored %d new frames\n", cache.stores);
+    }
+
+    if (animate) {
+        if (anim_args.ok) {
+            printf("\n✅ Done! Wrote %s\n", config->animate_path);
+            rc = 0;
+        } else {
+            printf("\n❌ Failed to write %s\n", config->animate_path);
+        }
+    } else {
+        printf("\n✅ Done! Extracted %d frames using %d threads!\n",
+               extract_count, NUM_SAVER_THREADS);
+        rc = 0;
+    }
+
+cleanup:
+    av_frame_free(&frame);
+    av_frame_free(&filtered);
+    filter_pipeline_free(&filter);
+    avcodec_free_context(&codec_ctx);
+    avformat_close_input(&fmt_ctx);
+    free(frames_to_extract);
+    free(name_list);
+    frame_index_free(&index);
+    if (use_cache) frame_cache_close(&cache);
+    return rc;
+}
+
+// ==================== INTERACTIVE SESSION ====================
+
+// -session: the input stays open and frames are requested one per line on
+// stdin, e.g. by a review tool while scrubbing:
+//     <n> | frame <n> | time <t> | quit
+// Each request is answered on stdout with "ok <n> <file> <ms>" or
+// "err <n> <reason>" (other lines are informational). Decoded frames stay
+// in a byte-bounded LRU of AVFrame references, and a request ahead of the
+// decoder within the same GOP decodes forward instead of seeking, so
+// near-sequential access costs one decode per frame.
+//
+// A prefetcher with its own demuxer and decoder watches the requests and,
+// once they form a sequential, strided or reverse pattern, decodes the
+// predicted frames into the same LRU before they are asked for.
+
+#define SESSION_CACHE_MB 512
+#define PREFETCH_AHEAD 8       // default -prefetch depth
+#define PREFETCH_MAX 256       // frames in one prefetch job (a reverse GOP)
+
+typedef struct {
+    int number;
+    AVFrame* frame;
+    size_t bytes;
+    uint64_t used;          // LRU clock
+} HotFrame;
+
+// Shared by the request loop and the prefetcher, hence the mutex.
+typedef struct {
+    HotFrame* entries;
+    int count;
+    int capacity;
+    size_t bytes;
+    size_t limit;
+    uint64_t tick;
+    pthread_mutex_t mutex;
+} HotFrameCache;
+
+static size_t hot_frame_bytes(const AVFrame* frame) {
+    int n = av_image_get_buffer_size((enum AVPixelFormat)frame->format, frame->width, frame->height, 1);
+    return n > 0 ? (size_t)n : 0;
+}
+
+static int hot_cache_find(HotFrameCache* c, int number) {
+    for (int i = 0; i < c->count; i++) {
+        if (c->entries[i].number == number) return i;
+    }
+    return -1;
+}
+
+static int hot_cache_has(HotFrameCache* c, int number) {
+    pthread_mutex_lock(&c->mutex);
+    int found = hot_cache_find(c, number) >= 0;
+    pthread_mutex_unlock(&c->mutex);
+    return found;
+}
+
+// New reference to a cached frame (the caller frees it), or NULL.
+static AVFrame* hot_cache_ref(HotFrameCache* c, int number) {
+    pthread_mutex_lock(&c->mutex);
+    int i = hot_cache_find(c, number);
+    AVFrame* ref = NULL;
+    if (i >= 0) {
+        c->entries[i].used = ++c->tick;
+        ref = av_frame_clone(c->entries[i].frame);
+    }
+    pthread_mutex_unlock(&c->mutex);
+    return ref;
+}
+
+// Keeps a reference to frame, evicting the least recently used entries
+// until it fits.
+static void hot_cache_put(HotFrameCache* c, int number, const AVFrame* frame) {
+    size_t bytes = hot_frame_bytes(frame);
+    pthread_mutex_lock(&c->mutex);
+    if (bytes > c->limit || hot_cache_find(c, number) >= 0) {
+        pthread_mutex_unlock(&c->mutex);
+        return;
+    }
+    while (c->count > 0 && c->bytes + bytes > c->limit) {
+        int oldest = 0;
+        for (int i = 1; i < c->count; i++) {
+            if (c->entries[i].used < c->entries[oldest].used) oldest = i;
+        }
+        c->bytes -= c->entries[oldest].bytes;
+        av_frame_free(&c->entries[oldest].frame);
+        c->entries[oldest] = c->entries[--c->count];
+    }
+    if (c->count == c->capacity) {
+        int capacity = c->capacity ? c->capacity * 2 : 64;
+        HotFrame* grown = (HotFrame*)realloc(c->entries, capacity * sizeof(HotFrame));
+        if (!grown) {
+            pthread_mutex_unlock(&c->mutex);
+            return;
+        }
+        c->entries = grown;
+        c->capacity = capacity;
+    }
+    AVFrame* ref = av_frame_clone(frame);
+    if (ref) {
+        c->entries[c->count++] = (HotFrame){number, ref, bytes, ++c->tick};
+        c->bytes += bytes;
+    }
+    pthread_mutex_unlock(&c->mutex);
+}
+
+static void hot_cache_free(HotFrameCache* c) {
+    for (int i = 0; i < c->count; i++) av_frame_free(&c->entries[i].frame);
+    free(c->entries);
+    c->entries = NULL;
+    c->count = c->capacity = 0;
+    c->bytes = 0;
+}
+
+// One demuxer + decoder position. The request loop and the prefetcher
+// each own one, so prefetching never moves the position requests rely on.
+typedef struct {
+    AVFormatContext* fmt_ctx;
+    AVStream* st;
+    int stream_idx;
+    AVCodecContext* dec;
+    AVPacket* pkt;
+    AVFrame* frame;
+    int next_frame;          // number the decoder outputs next, -1 = unknown
+    int eof;
+    const int* cancel;       // stop decoding when this becomes non-zero
+    int decodes, seeks;
+} SessionDecoder;
+
+static int session_decoder_open(SessionDecoder* d, Config* config, int stream_idx) {
+    memset(d, 0, sizeof(SessionDecoder));
+    d->stream_idx = stream_idx;
+    d->next_frame = -1;
+    if (avformat_open_input(&d->fmt_ctx, config->input, NULL, NULL) != 0) return 0;
+    avformat_find_stream_info(d->fmt_ctx, NULL);
+    if (stream_idx < 0) {
+        d->stream_idx = av_find_best_stream(d->fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    }
+    if (d->stream_idx < 0 || d->stream_idx >= (int)d->fmt_ctx->nb_streams) return 0;
+    d->st = d->fmt_ctx->streams[d->stream_idx];
+    for (int i = 0; i < (int)d->fmt_ctx->nb_streams; i++) {
+        if (i != d->stream_idx) d->fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    const AVCodec* codec = select_decoder(config, d->stream_idx, d->st->codecpar);
+    d->dec = codec ? avcodec_alloc_context3(codec) : NULL;
+    if (!d->dec || avcodec_parameters_to_context(d->dec, d->st->codecpar) < 0 ||
+        avcodec_open2(d->dec, codec, NULL) < 0) {
+        return 0;
+    }
+    d->pkt = av_packet_alloc();
+    d->frame = av_frame_alloc();
+    return d->pkt && d->frame;
+}
+
+static void session_decoder_close(SessionDecoder* d) {
+    av_frame_free(&d->frame);
+    av_packet_free(&d->pkt);
+    avcodec_free_context(&d->dec);
+    avformat_close_input(&d->fmt_ctx);
+}
+
+// Decodes forward, caching every frame on the way, until target comes out.
+// Returns a reference to it (the caller frees it), or NULL.
+static AVFrame* session_decode_until(SessionDecoder* d, const FrameIndex* index, HotFrameCache* hot,
+                                     int target) {
+    for (;;) {
+        while (avcodec_receive_frame(d->dec, d->frame) == 0) {
+            int64_t ts = frame_pts(d->frame);
+            int n = ts != AV_NOPTS_VALUE ? frame_index_lookup(index, ts) : -1;
+            if (n < 0) n = d->next_frame;
+            AVFrame* found = NULL;
+            if (n >= 0) {
+                d->next_frame = n + 1;
+                d->decodes++;
+                hot_cache_put(hot, n, d->frame);
+                if (n == target) found = av_frame_clone(d->frame);
+            }
+            av_frame_unref(d->frame);
+            if (n >= target) return found;
+        }
+        if (d->eof || (d->cancel && __atomic_load_n(d->cancel, __ATOMIC_RELAXED))) return NULL;
+
+        if (av_read_frame(d->fmt_ctx, d->pkt) < 0) {
+            d->eof = 1;
+            avcodec_send_packet(d->dec, NULL);
+            continue;
+        }
+        if (d->pkt->stream_index == d->stream_idx) {
+            avcodec_send_packet(d->dec, d->pkt);
+        }
+        av_packet_unref(d->pkt);
+    }
+}
+
+// Frame n from the cache or the decoder; a reference the caller frees.
+static AVFrame* session_fetch(SessionDecoder* d, const FrameIndex* index, HotFrameCache* hot,
+                              AVRational frame_duration, int n, int* hit) {
+    AVFrame* cached = hot_cache_ref(hot, n);
+    if (hit) *hit = cached != NULL;
+    if (cached) return cached;
+
+    // Ahead of the decoder and no keyframe after its position: a seek
+    // would land at or before where the decoder already is.
+    int forward = d->next_frame >= 0 && !d->eof && n >= d->next_frame &&
+                  frame_index_gop_start(index, n) <= d->next_frame;
+    if (!forward) {
+        av_seek_frame(d->fmt_ctx, d->stream_idx, frame_index_seek_pts(index, d->st, frame_duration, n),
+                      AVSEEK_FLAG_BACKWARD);
+        avcodec_flush_buffers(d->dec);
+        d->next_frame = -1;
+        d->eof = 0;
+        d->seeks++;
+    }
+    return session_decode_until(d, index, hot, n);
+}
+
+typedef struct {
+    SessionDecoder decoder;
+    const FrameIndex* index;
+    HotFrameCache* hot;
+    AVRational frame_duration;
+    pthread_t thread;
+    int running;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    int job[PREFETCH_MAX];   // frames to have in the cache, in decode order
+    int job_count;
+    int job_serial;          // bumped per job; the worker drops stale ones
+    int stop;
+    int superseded;          // set when a newer job arrives mid-decode
+    int prefetched;
+} Prefetcher;
+
+static void* prefetch_thread(void* arg) {
+    Prefetcher* p = (Prefetcher*)arg;
+    int job[PREFETCH_MAX];
+    int done_serial = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&p->mutex);
+        while (!p->stop && p->job_serial == done_serial) {
+            pthread_cond_wait(&p->wake, &p->mutex);
+        }
+        if (p->stop) {
+            pthread_mutex_unlock(&p->mutex);
+            break;
+        }
+        int count = p->job_count;
+        memcpy(job, p->job, count * sizeof(int));
+        done_serial = p->job_serial;
+        __atomic_store_n(&p->superseded, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&p->mutex);
+
+        for (int i = 0; i < count && !__atomic_load_n(&p->superseded, __ATOMIC_RELAXED); i++) {
+            if (hot_cache_has(p->hot, job[i])) continue;
+            AVFrame* f = session_fetch(&p->decoder, p->index, p->hot, p->frame_duration, job[i], NULL);
+            if (f) p->prefetched++;
+            av_frame_free(&f);
+        }
+    }
+    return NULL;
+}
+
+static void prefetch_post(Prefetcher* p, const int* frames, int count) {
+    pthread_mutex_lock(&p->mutex);
+    memcpy(p->job, frames, count * sizeof(int));
+    p->job_count = count;
+    p->job_serial++;
+    __atomic_store_n(&p->superseded, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->mutex);
+}
+
+// Predicts the next requests from the last three. A constant step of +1
+// is sequential, larger steps strided: the next `ahead` frames along the
+// step are fetched. A negative step is reverse playback: the GOP before
+// the current one is decoded whole, front to back, so the following
+// requests are served from its end.
+static int prefetch_plan(const int* last, const FrameIndex* index, int ahead, int* out) {
+    int step = last[2] - last[1];
+    if (step == 0 || last[1] - last[0] != step) return 0;
+
+    int count = 0;
+    if (step > 0) {
+        for (int k = 1; k <= ahead && count < PREFETCH_MAX; k++) {
+            int n = last[2] + step * k;
+            if (n >= index->count) break;
+            out[count++] = n;
+        }
+        return count;
+    }
+
+    int gop = frame_index_gop_start(index, last[2]);
+    if (gop <= 0) return 0;
+    int prev = frame_index_gop_start(index, gop - 1);
+    if (prev < 0) return 0;
+    // The rest of the current GOP first, in case it was evicted
+    for (int n = gop; n < last[2] && count < PREFETCH_MAX; n++) out[count++] = n;
+    for (int n = FFMAX(prev, gop - PREFETCH_MAX); n < gop && count < PREFETCH_MAX; n++) out[count++] = n;
+    return count;
+}
+
+static int session_save(Config* config, const FrameQueue* settings, const AVStream* st, int64_t first_pts,
+                        AVFrame* frame, int n, char* filename, size_t size) {
+    format_output_name(filename, size, config->output_pattern, n, frame_pts(frame),
+                       st->time_base, first_pts);
+    saved_file_name(filename, size, 0, FORMAT_PNG);
+
+    // Cached frames are shared; the conversion only reads them
+    int w, h;
+    uint8_t* rgb = convert_frame_rgb((FrameQueue*)settings, frame, &w, &h);
+    int ok = rgb && save_png(filename, rgb, w, h, settings->depth, settings->png_level);
+    free(rgb);
+    return ok;
+}
+
+int run_session(Config* config) {
+    SessionDecoder dec;
+    FrameIndex index;
+    memset(&index, 0, sizeof(FrameIndex));
+    if (!session_decoder_open(&dec, config, -1) ||
+        !frame_index_build(&index, dec.fmt_ctx, config->input, dec.stream_idx)) {
+        printf("❌ Cannot open an indexable video stream in %s\n", config->input);
+        session_decoder_close(&dec);
+        frame_index_free(&index);
+        return 1;
+    }
+    AVStream* st = dec.st;
+    AVRational frame_duration = st->avg_frame_rate.num > 0 ? av_inv_q(st->avg_frame_rate)
+                                                           : av_inv_q(st->r_frame_rate);
+    int64_t first_pts = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+
+    FrameQueue settings;
+    queue_init(&settings, st->codecpar->width, st->codecpar->height, FORMAT_PNG, 0,
+               config->output_pattern, 0);
+    queue_apply_config(&settings, config, st);
+
+    HotFrameCache hot;
+    memset(&hot, 0, sizeof(HotFrameCache));
+    pthread_mutex_init(&hot.mutex, NULL);
+    int cache_mb = config->session_cache_mb > 0 ? config->session_cache_mb : SESSION_CACHE_MB;
+    hot.limit = (size_t)cache_mb * 1024 * 1024;
+
+    // -prefetch 0 turns the prefetcher off
+    int ahead = config->prefetch >= 0 ? config->prefetch : PREFETCH_AHEAD;
+    Prefetcher* pf = NULL;
+    if (ahead > 0) {
+        pf = (Prefetcher*)calloc(1, sizeof(Prefetcher));
+        if (pf && session_decoder_open(&pf->decoder, config, dec.stream_idx)) {
+            pf->index = &index;
+            pf->hot = &hot;
+            pf->frame_duration = frame_duration;
+            pf->decoder.cancel = &pf->superseded;
+            pthread_mutex_init(&pf->mutex, NULL);
+            pthread_cond_init(&pf->wake, NULL);
+            pf->running = pthread_create(&pf->thread, NULL, prefetch_thread, pf) == 0;
+        }
+        if (pf && !pf->running) {
+            session_decoder_close(&pf->decoder);
+            free(pf);
+            pf = NULL;
+        }
+    }
+
+    double fps = av_q2d(av_inv_q(frame_duration));
+    printf("🎞️  Session: %s, %d frames, %d MB frame cache, prefetch %s. "
+           "Requests: <n> | frame <n> | time <t> | quit\n",
+           config->input, index.count, cache_mb, pf ? "on" : "off");
+    fflush(stdout);
+
+    int last[3] = {-1, -1, -1};
+    int hits = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), stdin)) {
+        char cmd[32] = "", arg[256] = "";
+        if (sscanf(line, "%31s %255s", cmd, arg) < 1) continue;
+        if (strcmp(cmd, "quit") == 0) break;
+
+        char* end;
+        int n = (int)strtol(cmd, &end, 10);
+        if (strcmp(cmd, "frame") == 0) {
+            n = atoi(arg);
+        } else if (strcmp(cmd, "time") == 0) {
+            n = frame_index_resolve_time(&index, parse_time_seconds(arg), st->time_base, fps,
+                                         config->snap_nearest);
+        } else if (*end != '\0' || end == cmd) {
+            printf("err - unknown request: %s\n", cmd);
+            fflush(stdout);
+            continue;
+        }
+        if (n < 0 || n >= index.count) {
+            printf("err %d out of range\n", n);
+            fflush(stdout);
+            continue;
+        }
+
+        Timer t;
+        timer_start(&t);
+        int hit = 0;
+        AVFrame* frame = session_fetch(&dec, &index, &hot, frame_duration, n, &hit);
+        hits += hit;
+
+        // Queue the prediction before encoding, so the prefetcher decodes
+        // while this frame is converted and written
+        last[0] = last[1];
+        last[1] = last[2];
+        last[2] = n;
+        if (pf) {
+            int plan[PREFETCH_MAX];
+            int count = prefetch_plan(last, &index, ahead, plan);
+            if (count > 0) prefetch_post(pf, plan, count);
+        }
+
+        char filename[512];
+        if (!frame) {
+            printf("err %d decode failed\n", n);
+        } else if (!session_save(config, &settings, st, first_pts, frame, n, filename, sizeof(filename))) {
+            printf("err %d cannot write %s\n", n, filename);
+        } else {
+            printf("ok %d %s %.1f\n", n, filename, timer_elapsed(t) * 1000.0);
+        }
+        fflush(stdout);
+        av_frame_free(&frame);
+    }
+
+    if (pf) {
+        pthread_mutex_lock(&pf->mutex);
+        pf->stop = 1;
+        __atomic_store_n(&pf->superseded, 1, __ATOMIC_RELAXED);
+        pthread_cond_signal(&pf->wake);
+        pthread_mutex_unlock(&pf->mutex);
+        pthread_join(pf->thread, NULL);
+    }
 
-            struct SwsContext* sws_ctx = sws_getContext(
-                q->width, q->height, frame->format,
-                q->width, q->height, AV_PIX_FMT_RGB24,
-                SWS_BILINEAR, NULL, NULL, NULL
-            );
+    printf("📊 Session: %d cache hits, %d frames decoded, %d seeks", hits, dec.decodes, dec.seeks);
+    if (pf) {
+        printf(" (prefetched %d, %d decoded ahead)", pf->prefetched, pf->decoder.decodes);
+    }
+    printf("\n");
 
-            if (sws_ctx) {
-                uint8_t* rgb_data = (uint8_t*)malloc(q->width * q->height * 3);
-                uint8_t* rgb_ptrs[1] = {rgb_data};
-                int rgb_linesize[1] = {q->width * 3};
+    if (pf) {
+        session_decoder_close(&pf->decoder);
+        pthread_mutex_destroy(&pf->mutex);
+        pthread_cond_destroy(&pf->wake);
+        free(pf);
+    }
+    hot_cache_free(&hot);
+    pthread_mutex_destroy(&hot.mutex);
+    queue_destroy(&settings);
+    session_decoder_close(&dec);
+    frame_index_free(&index);
+    return 0;
+}
 
-                sws_scale(sws_ctx, (const uint8_t* const*)frame->data, frame->linesize, 
-                         0, q->height, rgb_ptrs, rgb_linesize);
+// ==================== MICROBENCHMARKS ====================
 
-                save_png(filename, rgb_data, q->width, q->height);
+#define BENCH_MIN_SECONDS 0.3
 
-                free(rgb_data);
-                sws_freeContext(sws_ctx);
+typedef struct {
+    const char* name;
+    double seconds;
+    long ops;
+    double bytes_per_op;
+} BenchResult;
+
+static void bench_print(BenchResult r) {
+    double ns_per_op = r.ops > 0 ? r.seconds * 1e9 / r.ops : 0;
+    printf("   %-34s %10.0f ns/op %12.0f ops/s", r.name, ns_per_op,
+           r.seconds > 0 ? r.ops / r.seconds : 0);
+    if (r.bytes_per_op > 0 && r.seconds > 0) {
+        printf(" %9.1f MB/s", r.bytes_per_op * r.ops / r.seconds / (1024.0 * 1024.0));
+    }
+    printf("\n");
+}
+
+// Synthetic YUV420P content: gradients that drift with the frame index plus
+// a little noise, so that both deflate and video encoders have something
+// realistic to chew on.
+static void bench_fill_frame(AVFrame* f, int index) {
+    uint32_t seed = 12345 + index;
+    for (int y = 0; y < f->height; y++) {
+        uint8_t* row = f->data[0] + y * f->linesize[0];
+        for (int x = 0; x < f->width; x++) {
+            seed = seed * 1103515245 + 12345;
+            row[x] = (uint8_t)(((x + y + 4 * index) >> 2) + ((seed >> 16) & 7));
+        }
+    }
+    for (int p = 1; p < 3; p++) {
+        for (int y = 0; y < f->height / 2; y++) {
+            uint8_t* row = f->data[p] + y * f->linesize[p];
+            for (int x = 0; x < f->width / 2; x++) {
+                row[x] = (uint8_t)(p == 1 ? 128 + ((x + index) >> 4) : 128 - ((y + index) >> 4));
             }
         }
+    }
+}
 
-        av_frame_free(&frame);
-        q->frames_saved++;
-        progress_update(progress, 1, 0);
+static AVFrame* bench_make_frame(int width, int height) {
+    AVFrame* f = av_frame_alloc();
+    if (!f) return NULL;
+    f->format = AV_PIX_FMT_YUV420P;
+    f->width = width;
+    f->height = height;
+    if (av_frame_get_buffer(f, 32) < 0) {
+        av_frame_free(&f);
+        return NULL;
     }
+    bench_fill_frame(f, 0);
+    return f;
+}
 
-    return NULL;
+static uint8_t* bench_make_rgb(AVFrame* f) {
+    uint8_t* rgb = (uint8_t*)malloc(f->width * f->height * 3);
+    struct SwsContext* sws = sws_getContext(f->width, f->height, f->format,
+                                            f->width, f->height, AV_PIX_FMT_RGB24,
+                                            SWS_BILINEAR, NULL, NULL, NULL);
+    uint8_t* dst[1] = {rgb};
+    int dst_linesize[1] = {f->width * 3};
+    sws_scale(sws, (const uint8_t* const*)f->data, f->linesize, 0, f->height, dst, dst_linesize);
+    sws_freeContext(sws);
+    return rgb;
 }
 
-// ==================== MEDIA EXTRACTOR CONFIG ====================
+// threads 0: libpng save_png(), otherwise save_png_parallel().
+static void bench_save_png(int width, int height, int level, int threads, const char* path) {
+    AVFrame* f = bench_make_frame(width, height);
+    uint8_t* rgb = bench_make_rgb(f);
 
-typedef struct {
-    char input[512];
-    char output_pattern[512];
-    char audio_output[512];
-    int frames[1024];
-    int frame_count;
-    int start_frame;
-    int end_frame;
-    int step;
-    int format;
-    int fast_mode;
-    int extract_audio;
-    int audio_only;
-    int audio_format;
-    int audio_bitrate;
-    int use_time;
-    int use_time_range;
-    char time_str[64];
-    char start_time[64];
-    char end_time[64];
-    char ytdl_url[1024];      // New: YouTube URL
-    char ytdl_format[64];      // New: yt-dlp format
-    int ytdl_download;         // New: flag for yt-dlp
-} Config;
+    char name[64];
+    if (threads > 0) {
+        snprintf(name, sizeof(name), "save_png_parallel %dx%d level %d x%d", width, height, level, threads);
+    } else {
+        snprintf(name, sizeof(name), "save_png %dx%d level %d", width, height, level);
+    }
 
-void print_usage() {
-    printf("\n🎬 === Frame Extractor v10.0 (YOUTUBE EDITION) ===\n");
-    printf("Extract frames/audio from local videos OR YouTube URLs!\n\n");
-    printf("Usage: frame_extractor -input <video> [options]\n");
-    printf("   OR: frame_extractor -ytdl <url> [options]\n\n");
+    BenchResult r = {name, 0, 0, width * height * 3.0};
+    Timer t;
+    timer_start(&t);
+    do {
+        if (threads > 0) {
+            save_png_parallel(path, rgb, width, height, (size_t)width * 3, 8, level, threads);
+        } else {
+            save_png(path, rgb, width, height, 8, level);
+        }
+        r.ops++;
+    } while ((r.seconds = timer_elapsed(t)) < BENCH_MIN_SECONDS);
+    bench_print(r);
 
-    printf("📹 FRAME OPTIONS:\n");
-    printf("  -output <pattern>     Output filename pattern (e.g., frame_%%03d.png)\n");
-    printf("  -frame <n>            Extract single frame\n");
-    printf("  -frames <n1,n2,n3>    Extract specific frames\n");
-    printf("  -range <start> <end>  Extract range of frames\n");
-    printf("  -step <n>             Step for range extraction\n");
-    printf("  -time <time>          Extract frame at time\n");
-    printf("  -time-range <start> <end>  Extract frames between times\n");
-    printf("  -fast                  FAST MODE: save raw YUV\n\n");
+    remove(path);
+    free(rgb);
+    av_frame_free(&f);
+}
 
-    printf("🎵 AUDIO OPTIONS:\n");
-    printf("  -extract-audio        Extract audio along with frames\n");
-    printf("  -audio-only           Extract audio only\n");
-    printf("  -output-audio <file>  Audio output filename\n");
-    printf("  -audio-format <fmt>   mp3, aac, wav, ogg (default: mp3)\n");
-    printf("  -audio-bitrate <kbps> Bitrate for audio (32-320, default: 128)\n\n");
+#ifdef HAVE_LIBDEFLATE
+static void bench_save_png_fast(int width, int height, int level, const char* path) {
+    AVFrame* f = bench_make_frame(width, height);
+    uint8_t* rgb = bench_make_rgb(f);
+    PngEncoder enc;
+    png_encoder_init(&enc, level);
+
+    char name[64];
+    snprintf(name, sizeof(name), "save_png_fast %dx%d level %d", width, height, level);
+
+    BenchResult r = {name, 0, 0, width * height * 3.0};
+    Timer t;
+    timer_start(&t);
+    do {
+        save_png_fast(&enc, path, rgb, width, height, (size_t)width * 3, 8);
+        r.ops++;
+    } while ((r.seconds = timer_elapsed(t)) < BENCH_MIN_SECONDS);
+    bench_print(r);
+
+    remove(path);
+    png_encoder_free(&enc);
+    free(rgb);
+    av_frame_free(&f);
+}
+#endif
 
-    printf("🌐 YOUTUBE OPTIONS (NEW!):\n");
-    printf("  -ytdl <url>           Download from YouTube first\n");
-    printf("  -ytdl-format <fmt>    yt-dlp format (default: auto)\n");
-    printf("                         auto = best for your needs\n\n");
+static void bench_save_yuv(int width, int height, const char* path) {
+    AVFrame* f = bench_make_frame(width, height);
 
-    printf("🚀 YOUTUBE EXAMPLES:\n");
-    printf("  # Download and extract audio\n");
-    printf("  frame_extractor -ytdl \"https://youtu.be/...\" -audio-only -output-audio song.mp3\n\n");
-    printf("  # Download and extract frame at 1:30\n");
-    printf("  frame_extractor -ytdl \"https://youtu.be/...\" -time 00:01:30 -output thumbnail.png\n\n");
-    printf("  # Download best video, extract frames 100-200\n");
-    printf("  frame_extractor -ytdl \"https://youtu.be/...\" -range 100 200 -output frames/%%03d.png\n");
+    char name[64];
+    snprintf(name, sizeof(name), "save_yuv_frame %dx%d", width, height);
+
+    BenchResult r = {name, 0, 0, width * height * 1.5};
+    Timer t;
+    timer_start(&t);
+    do {
+        save_yuv_frame(f, path, width, height);
+        r.ops++;
+    } while ((r.seconds = timer_elapsed(t)) < BENCH_MIN_SECONDS);
+    bench_print(r);
+
+    remove(path);
+    av_frame_free(&f);
 }
 
-int parse_frames_string(const char* str, int* frames, int* count) {
-    char temp[1024];
-    strcpy(temp, str);
-    *count = 0;
+// Times the conversion exactly as frame_saver_thread does it (context and
+// buffer created per frame) and with both kept across frames.
+static void bench_swscale(int width, int height) {
+    AVFrame* f = bench_make_frame(width, height);
+    int dst_linesize[1] = {width * 3};
+
+    char name[64];
+    snprintf(name, sizeof(name), "swscale->RGB24 %dx%d per-frame", width, height);
+    BenchResult r = {name, 0, 0, width * height * 3.0};
+    Timer t;
+    timer_start(&t);
+    do {
+        struct SwsContext* sws = sws_getContext(width, height, f->format,
+                                                width, height, AV_PIX_FMT_RGB24,
+                                                SWS_BILINEAR, NULL, NULL, NULL);
+        uint8_t* rgb = (uint8_t*)malloc(width * height * 3);
+        uint8_t* dst[1] = {rgb};
+        sws_scale(sws, (const uint8_t* const*)f->data, f->linesize, 0, height, dst, dst_linesize);
+        free(rgb);
+        sws_freeContext(sws);
+        r.ops++;
+    } while ((r.seconds = timer_elapsed(t)) < BENCH_MIN_SECONDS);
+    bench_print(r);
+
+    snprintf(name, sizeof(name), "swscale->RGB24 %dx%d cached", width, height);
+    BenchResult rc = {name, 0, 0, width * height * 3.0};
+    struct SwsContext* sws = sws_getContext(width, height, f->format,
+                                            width, height, AV_PIX_FMT_RGB24,
+                                            SWS_BILINEAR, NULL, NULL, NULL);
+    uint8_t* rgb = (uint8_t*)malloc(width * height * 3);
+    uint8_t* dst[1] = {rgb};
+    timer_start(&t);
+    do {
+        sws_scale(sws, (const uint8_t* const*)f->data, f->linesize, 0, height, dst, dst_linesize);
+        rc.ops++;
+    } while ((rc.seconds = timer_elapsed(t)) < BENCH_MIN_SECONDS);
+    bench_print(rc);
+
+    free(rgb);
+    sws_freeContext(sws);
+    av_frame_free(&f);
+}
 
-    char* token = strtok(temp, ",");
-    while (token != NULL && *count < 1024) {
-        frames[*count] = atoi(token);
-        (*count)++;
-        token = strtok(NULL, ",");
+static void* bench_queue_consumer(void* arg) {
+    FrameQueue* q = (FrameQueue*)arg;
+    AVFrame* frame;
+    int frame_number;
+    while (queue_pop(q, &frame, &frame_number, NULL)) {
+        av_frame_free(&frame);
     }
-    return *count > 0;
+    return NULL;
 }
 
-int parse_time_to_frame(const char* time_str, double fps) {
-    int h, m, s;
-    double ms = 0.0;
-    double seconds = 0;
-
-    if (sscanf(time_str, "%d:%d:%d.%lf", &h, &m, &s, &ms) == 4) {
-        seconds = h * 3600 + m * 60 + s + ms;
-    } else if (sscanf(time_str, "%d:%d:%d", &h, &m, &s) == 3) {
-        seconds = h * 3600 + m * 60 + s;
-    } else if (sscanf(time_str, "%d:%d", &m, &s) == 2) {
-        seconds = m * 60 + s;
-    } else {
-        seconds = atof(time_str);
+static void bench_queue(int consumers, int frames) {
+    AVFrame* f = bench_make_frame(64, 64);
+    FrameQueue q;
+    queue_init(&q, 64, 64, 0, 0, "bench_%d", frames);
+
+    pthread_t threads[NUM_SAVER_THREADS * 4];
+    Timer t;
+    timer_start(&t);
+    for (int i = 0; i < consumers; i++) {
+        pthread_create(&threads[i], NULL, bench_queue_consumer, &q);
+    }
+    for (int i = 0; i < frames; i++) {
+        queue_push(&q, f, i);
     }
+    queue_set_done(&q);
+    for (int i = 0; i < consumers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "queue_push/pop %d consumer%s", consumers,
+             consumers == 1 ? "" : "s");
+    BenchResult r = {name, timer_elapsed(t), frames, 0};
+    bench_print(r);
 
-    return (int)(seconds * fps);
+    queue_destroy(&q);
+    av_frame_free(&f);
 }
 
-int64_t time_to_pts(const char* time_str, AVRational time_base) {
-    int h, m, s;
-    double ms = 0.0;
-    double seconds = 0;
-
-    if (sscanf(time_str, "%d:%d:%d.%lf", &h, &m, &s, &ms) == 4) {
-        seconds = h * 3600 + m * 60 + s + ms;
-    } else if (sscanf(time_str, "%d:%d:%d", &h, &m, &s) == 3) {
-        seconds = h * 3600 + m * 60 + s;
-    } else if (sscanf(time_str, "%d:%d", &m, &s) == 2) {
-        seconds = m * 60 + s;
-    } else {
-        seconds = atof(time_str);
-    }
+typedef struct {
+    ProgressTracker* progress;
+    int updates;
+} BenchProgressArgs;
 
-    return (int64_t)(seconds * time_base.den / time_base.num);
+static void* bench_progress_worker(void* arg) {
+    BenchProgressArgs* a = (BenchProgressArgs*)arg;
+    for (int i = 0; i < a->updates; i++) {
+        progress_update(a->progress, 1, 0);
+    }
+    return NULL;
 }
 
-int frame_in_list(int frame, int* list, int count) {
-    for (int i = 0; i < count; i++) {
-        if (list[i] == frame) return 1;
+static void bench_progress(int threads, int updates_per_thread) {
+    ProgressTracker pt;
+    progress_init(&pt, threads * updates_per_thread);
+    pt.silent = 1;
+
+    pthread_t tids[NUM_SAVER_THREADS * 4];
+    BenchProgressArgs args = {&pt, updates_per_thread};
+    Timer t;
+    timer_start(&t);
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, bench_progress_worker, &args);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
     }
-    return 0;
-}
 
-// ==================== PATH FIXING FOR WINDOWS ====================
+    char name[64];
+    snprintf(name, sizeof(name), "progress_update %d thread%s", threads, threads == 1 ? "" : "s");
+    BenchResult r = {name, timer_elapsed(t), (long)threads * updates_per_thread, 0};
+    bench_print(r);
+    pthread_mutex_destroy(&pt.progress_mutex);
+}
 
-void fix_windows_path(char* path) {
-    for (int i = 0; path[i]; i++) {
-        if (path[i] == '\\') {
-            path[i] = '/';
+static void bench_frame_in_list(int list_size) {
+    int* list = (int*)malloc(list_size * sizeof(int));
+    for (int i = 0; i < list_size; i++) list[i] = i * 7;
+
+    char name[64];
+    snprintf(name, sizeof(name), "frame_in_list n=%d", list_size);
+    BenchResult r = {name, 0, 0, 0};
+    volatile int hits = 0;
+    int probe = 0;
+    Timer t;
+    timer_start(&t);
+    do {
+        for (int i = 0; i < 1000; i++) {
+            hits += frame_in_list(probe, list, list_size);
+            probe = (probe + 13) % (list_size * 7);
         }
-    }
+        r.ops += 1000;
+    } while ((r.seconds = timer_elapsed(t)) < BENCH_MIN_SECONDS);
+    bench_print(r);
+    free(list);
 }
 
-// ==================== YT-DLP DOWNLOAD FUNCTION ====================
+int run_microbench() {
+    static const int sizes[][2] = {{640, 360}, {1920, 1080}, {3840, 2160}};
+    static const int levels[] = {0, 1, 6, 9};
+    const int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+    const char* png_path = "microbench_tmp.png";
+    const char* yuv_path = "microbench_tmp.yuv";
 
-int download_from_youtube(Config* config) {
-    printf("\n🌐 === YOUTUBE DOWNLOAD ===\n");
+    printf("\n⏱️ === MICROBENCHMARKS ===\n");
 
-    // Check if yt-dlp is installed
-    if (system("yt-dlp --version > /dev/null 2>&1") != 0) {
-        printf("❌ yt-dlp not found! Install with: pip install yt-dlp\n");
-        return 0;
+    printf("\n🖼️ PNG encoding:\n");
+    for (int s = 0; s < nsizes; s++) {
+        for (int l = 0; l < (int)(sizeof(levels) / sizeof(levels[0])); l++) {
+            bench_save_png(sizes[s][0], sizes[s][1], levels[l], 0, png_path);
+        }
     }
-
-    // Smart format selection
-    const char* format;
-    if (config->audio_only) {
-        format = "bestaudio";
-        printf("🎵 Audio-only mode: downloading best audio\n");
+    for (int threads = 1; threads <= cpu_count(); threads *= 2) {
+        bench_save_png(sizes[nsizes - 1][0], sizes[nsizes - 1][1], 6, threads, png_path);
     }
-    else if (config->frame_count > 0 || config->use_time_range || config->start_frame > 0) {
-        format = "bestvideo[ext=mp4]";
-        printf("📹 Frame extraction: downloading best video\n");
+#ifdef HAVE_LIBDEFLATE
+    for (int s = 0; s < nsizes; s++) {
+        for (int l = 0; l < (int)(sizeof(levels) / sizeof(levels[0])); l++) {
+            bench_save_png_fast(sizes[s][0], sizes[s][1], levels[l], png_path);
+        }
     }
-    else if (config->extract_audio) {
-        format = "bestvideo+bestaudio";
-        printf("🎬 Video+Audio: downloading both\n");
+#endif
+
+    printf("\n💾 Raw YUV writing:\n");
+    for (int s = 0; s < nsizes; s++) {
+        bench_save_yuv(sizes[s][0], sizes[s][1], yuv_path);
     }
-    else {
-        format = "best[ext=mp4]";
-        printf("📥 Default: downloading best MP4\n");
+
+    printf("\n🎨 Conversion:\n");
+    for (int s = 0; s < nsizes; s++) {
+        bench_swscale(sizes[s][0], sizes[s][1]);
     }
 
-    // Use custom format if specified
-    if (config->ytdl_format[0] != '\0') {
-        format = config->ytdl_format;
-        printf("📥 Using custom format: %s\n", format);
+    printf("\n📦 Frame queue:\n");
+    for (int c = 1; c <= NUM_SAVER_THREADS * 2; c *= 2) {
+        bench_queue(c, 20000);
     }
 
-    // Build download command
-    char cmd[4096];
-    snprintf(cmd, sizeof(cmd),
-             "yt-dlp -f '%s' --newline --progress -o 'ytdl_%%(title)s.%%(ext)s' '%s'",
-             format, config->ytdl_url);
+    printf("\n📊 Progress tracker:\n");
+    for (int n = 1; n <= NUM_SAVER_THREADS * 2; n *= 2) {
+        bench_progress(n, 200000 / n);
+    }
 
-    printf("\n🔄 Downloading...\n");
-    fflush(stdout);
+    printf("\n🔎 Frame list lookup:\n");
+    bench_frame_in_list(16);
+    bench_frame_in_list(256);
+    bench_frame_in_list(1024);
 
-    // Run download and show progress
-    FILE* fp = popen(cmd, "r");
-    if (!fp) {
-        printf("❌ Failed to run yt-dlp\n");
-        return 0;
-    }
+    printf("\n");
+    return 0;
+}
 
-    char line[512];
-    while (fgets(line, sizeof(line), fp) != NULL) {
-        if (strstr(line, "[download]") && strstr(line, "%")) {
-            // Extract percentage
-            char* percent_str = strstr(line, " ");
-            if (percent_str) {
-                percent_str++;
-                char* end = strchr(percent_str, '%');
-                if (end) *end = '\0';
-                printf("\r   ⬇️  Downloaded: %s%%", percent_str);
-                fflush(stdout);
-            }
-        }
-    }
+// ==================== PERFORMANCE REGRESSION CHECK ====================
 
-    int status = pclose(fp);
-    if (status != 0) {
-        printf("\n❌ Download failed!\n");
-        return 0;
+#define PERFCHECK_CLIP_DIR "perfcheck_clips"
+#define PERFCHECK_OUT_DIR "perfcheck_out"
+#define PERFCHECK_DEFAULT_RUNS 5
+#define PERFCHECK_FPS_TOLERANCE_PCT 10.0
+#define PERFCHECK_P99_TOLERANCE_PCT 25.0
+
+typedef struct {
+    const char* name;
+    int width;
+    int height;
+    int clip_frames;
+    int fast_mode;
+    int start_frame;     // -range start (0 = from the beginning)
+    int end_frame;       // -range end (0 = to the end)
+    int step;
+    int single_frame;    // -frame n (-1 = unused)
+} PerfScenario;
+
+static const PerfScenario perf_scenarios[] = {
+    {"360p_png_all",     640,  360, 240, 0,  0,   0,  1, -1},
+    {"360p_yuv_all",     640,  360, 240, 1,  0,   0,  1, -1},
+    {"1080p_png_all",   1920, 1080,  96, 0,  0,   0,  1, -1},
+    {"1080p_yuv_all",   1920, 1080,  96, 1,  0,   0,  1, -1},
+    {"1080p_png_step8", 1920, 1080,  96, 0,  0,   0,  8, -1},
+    {"1080p_png_seek",  1920, 1080,  96, 0, 70,  70,  1, -1},
+};
+
+// Encodes a deterministic MPEG-4 Part 2 clip (every FFmpeg build ships that
+// encoder). B-frames are enabled so reordering is exercised too.
+static int generate_synthetic_clip(const char* path, int width, int height, int frames, int fps) {
+    const AVCodec* enc = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+    if (!enc) return 0;
+
+    AVFormatContext* oc = NULL;
+    if (avformat_alloc_output_context2(&oc, NULL, NULL, path) < 0 || !oc) return 0;
+
+    AVStream* st = avformat_new_stream(oc, NULL);
+    AVCodecContext* ctx = avcodec_alloc_context3(enc);
+    AVFrame* f = bench_make_frame(width, height);
+    AVPacket* pkt = av_packet_alloc();
+    int ok = 0;
+
+    if (!st || !ctx || !f || !pkt) goto done;
+
+    ctx->width = width;
+    ctx->height = height;
+    ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    ctx->time_base = (AVRational){1, fps};
+    ctx->framerate = (AVRational){fps, 1};
+    ctx->gop_size = 12;
+    ctx->max_b_frames = 2;
+    ctx->bit_rate = (int64_t)width * height * fps / 4;
+    if (oc->oformat->flags & AVFMT_GLOBALHEADER) {
+        ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
     }
+    if (avcodec_open2(ctx, enc, NULL) < 0) goto done;
 
-    printf("\r   ⬇️  Download complete!          \n");
+    st->time_base = ctx->time_base;
+    st->avg_frame_rate = ctx->framerate;
+    avcodec_parameters_from_context(st->codecpar, ctx);
 
-    // Find the downloaded file
-    FILE* ls_fp = popen("ls ytdl_* 2>/dev/null | head -1", "r");
-    if (!ls_fp) {
-        printf("❌ Cannot find downloaded file\n");
-        return 0;
-    }
-    
-    char downloaded_filename[512];  // ← USE A TEMPORARY BUFFER
-    if (fgets(downloaded_filename, sizeof(downloaded_filename), ls_fp) == NULL) {
-        printf("❌ No downloaded file found\n");
-        pclose(ls_fp);
-        return 0;
+    if (avio_open(&oc->pb, path, AVIO_FLAG_WRITE) < 0) goto done;
+    if (avformat_write_header(oc, NULL) < 0) goto done;
+
+    for (int i = 0; i <= frames; i++) {
+        if (i < frames) {
+            av_frame_make_writable(f);
+            bench_fill_frame(f, i);
+            f->pts = i;
+        }
+        if (avcodec_send_frame(ctx, i < frames ? f : NULL) < 0) break;
+        while (avcodec_receive_packet(ctx, pkt) == 0) {
+            av_packet_rescale_ts(pkt, ctx->time_base, st->time_base);
+            pkt->stream_index = st->index;
+            av_interleaved_write_frame(oc, pkt);
+        }
     }
-    pclose(ls_fp);
-    
-    // Remove newline from temporary buffer
-    downloaded_filename[strcspn(downloaded_filename, "\n")] = '\0';
-    
-    printf("📂 Downloaded: %s\n", config->input);
-    return 1;
+    ok = av_write_trailer(oc) == 0;
+
+done:
+    if (oc && oc->pb) avio_closep(&oc->pb);
+    av_packet_free(&pkt);
+    av_frame_free(&f);
+    avcodec_free_context(&ctx);
+    avformat_free_context(oc);
+    return ok;
 }
 
-// ==================== FFMPEG AUDIO EXTRACTION ====================
-
-const char* get_audio_codec(int format) {
-    switch(format) {
-        case 0: return "libmp3lame";
-        case 1: return "aac";
-        case 2: return "pcm_s16le";
-        case 3: return "libvorbis";
-        default: return "libmp3lame";
+// The extraction pipeline reports to stdout; during timed runs that output
+// is sent to the null device so terminal speed doesn't skew the numbers.
+static int stdout_silence() {
+    fflush(stdout);
+    int saved = dup(fileno(stdout));
+#ifdef _WIN32
+    FILE* devnull = fopen("NUL", "w");
+#else
+    FILE* devnull = fopen("/dev/null", "w");
+#endif
+    if (devnull) {
+        dup2(fileno(devnull), fileno(stdout));
+        fclose(devnull);
     }
+    return saved;
 }
 
-const char* get_audio_extension(int format) {
-    switch(format) {
-        case 0: return "mp3";
-        case 1: return "m4a";
-        case 2: return "wav";
-        case 3: return "ogg";
-        default: return "mp3";
+static void stdout_restore(int saved) {
+    fflush(stdout);
+    if (saved >= 0) {
+        dup2(saved, fileno(stdout));
+        close(saved);
     }
 }
 
-const char* get_bitrate_option(int format, int bitrate) {
-    static char option[64];
-    if (bitrate <= 0) bitrate = 128;
-    snprintf(option, sizeof(option), "-b:a %dk", bitrate);
-    return option;
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
 }
 
-void* extract_audio_thread(void* arg) {
-    Config* config = (Config*)arg;
+// Finds "key": <number> inside the object that follows "scenario": in the
+// baseline file. The file is written by perfcheck_write_baseline(), so this
+// deliberately understands only that shape.
+static int json_scenario_number(const char* json, const char* scenario, const char* key, double* out) {
+    char needle[128];
+    snprintf(needle, sizeof(needle), "\"%s\"", scenario);
+    const char* obj = strstr(json, needle);
+    if (!obj) return 0;
+    obj = strchr(obj + strlen(needle), '{');
+    if (!obj) return 0;
+    const char* obj_end = strchr(obj, '}');
+    if (!obj_end) return 0;
+
+    snprintf(needle, sizeof(needle), "\"%s\"", key);
+    const char* field = strstr(obj, needle);
+    if (!field || field > obj_end) return 0;
+    const char* colon = strchr(field + strlen(needle), ':');
+    if (!colon || colon > obj_end) return 0;
+
+    char* end;
+    *out = strtod(colon + 1, &end);
+    return end != colon + 1;
+}
 
-    printf("\n🎵 === AUDIO EXTRACTION (FFmpeg) ===\n");
+static char* read_text_file(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* text = (char*)malloc(size + 1);
+    if (text) {
+        size_t n = fread(text, 1, size, fp);
+        text[n] = '\0';
+    }
+    fclose(fp);
+    return text;
+}
 
-    // Check if ffmpeg is installed
-    if (system("ffmpeg -version > /dev/null 2>&1") != 0) {
-        printf("❌ FFmpeg not found! Install with: pkg install ffmpeg\n");
-        return NULL;
+typedef struct {
+    double median_fps;
+    double p99_ms;
+} PerfResult;
+
+static int perfcheck_write_baseline(const char* path, const PerfResult* results, int count) {
+    FILE* fp = fopen(path, "w");
+    if (!fp) return 0;
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"tolerance\": {\"fps_pct\": %.1f, \"p99_pct\": %.1f},\n",
+            PERFCHECK_FPS_TOLERANCE_PCT, PERFCHECK_P99_TOLERANCE_PCT);
+    fprintf(fp, "  \"scenarios\": {\n");
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "    \"%s\": {\"fps\": %.2f, \"p99_ms\": %.3f}%s\n", perf_scenarios[i].name,
+                results[i].median_fps, results[i].p99_ms, i + 1 < count ? "," : "");
     }
+    fprintf(fp, "  }\n}\n");
+    fclose(fp);
+    return 1;
+}
 
-    const char* codec = get_audio_codec(config->audio_format);
-    const char* ext = get_audio_extension(config->audio_format);
-    const char* bitrate_opt = get_bitrate_option(config->audio_format, config->audio_bitrate);
+static int run_perf_scenario(const PerfScenario* sc, const char* clip, int runs, PerfResult* result) {
+    double* fps_runs = (double*)malloc(runs * sizeof(double));
+    double* latencies = NULL;
+    int latency_count = 0;
+
+    for (int r = 0; r < runs; r++) {
+        Config config;
+        memset(&config, 0, sizeof(Config));
+        strcpy(config.input, clip);
+        snprintf(config.output_pattern, sizeof(config.output_pattern),
+                 "%s" PATH_SEP_STR "%s_%%04d", PERFCHECK_OUT_DIR, sc->name);
+        config.fast_mode = sc->fast_mode;
+        config.png_level = -1;
+        config.step = sc->step;
+        if (sc->single_frame >= 0) {
+            config.frames[0] = sc->single_frame;
+            config.frame_count = 1;
+        } else {
+            config.start_frame = sc->start_frame;
+            config.end_frame = sc->end_frame;
+        }
 
-    char final_output[512];
-    strcpy(final_output, config->audio_output);
+        RunStats stats;
+        memset(&stats, 0, sizeof(stats));
+
+        Timer t;
+        int saved_stdout = stdout_silence();
+        timer_start(&t);
+        int rc = extract_frames(&config, &stats);
+        double elapsed = timer_elapsed(t);
+        stdout_restore(saved_stdout);
+
+        if (rc != 0 || stats.frames_saved == 0) {
+            printf("   ❌ %s: run %d failed\n", sc->name, r + 1);
+            free(stats.latencies);
+            free(fps_runs);
+            free(latencies);
+            return 0;
+        }
 
-    if (strstr(final_output, ".") == NULL) {
-        char temp[512];
-        snprintf(temp, sizeof(temp), "%s.%s", config->audio_output, ext);
-        strcpy(final_output, temp);
+        fps_runs[r] = stats.frames_saved / elapsed;
+        latencies = (double*)realloc(latencies, (latency_count + stats.latency_count) * sizeof(double));
+        memcpy(latencies + latency_count, stats.latencies, stats.latency_count * sizeof(double));
+        latency_count += stats.latency_count;
+        free(stats.latencies);
     }
 
-    char fixed_input[512];
-    strcpy(fixed_input, config->input);
-    fix_windows_path(fixed_input);
-    fix_windows_path(final_output);
+    qsort(fps_runs, runs, sizeof(double), compare_doubles);
+    result->median_fps = (runs % 2) ? fps_runs[runs / 2]
+                                    : 0.5 * (fps_runs[runs / 2 - 1] + fps_runs[runs / 2]);
 
-    printf("📂 Input: %s\n", fixed_input);
-    printf("📂 Output: %s\n", final_output);
-    printf("🎵 Format: %s (%s)\n", ext, codec);
-    if (config->audio_bitrate > 0) printf("🎚️ Bitrate: %d kbps\n", config->audio_bitrate);
+    result->p99_ms = 0;
+    if (latency_count > 0) {
+        qsort(latencies, latency_count, sizeof(double), compare_doubles);
+        int idx = (int)ceil(0.99 * latency_count) - 1;
+        if (idx < 0) idx = 0;
+        result->p99_ms = latencies[idx] * 1000.0;
+    }
 
-    char time_option[256] = "";
-    if (config->use_time_range) {
-        double start_seconds = 0, end_seconds = 0;
-        int h, m, s;
+    free(fps_runs);
+    free(latencies);
+    return 1;
+}
 
-        if (sscanf(config->start_time, "%d:%d:%d", &h, &m, &s) == 3) start_seconds = h * 3600 + m * 60 + s;
-        else if (sscanf(config->start_time, "%d:%d", &m, &s) == 2) start_seconds = m * 60 + s;
-        else start_seconds = atof(config->start_time);
+// Runs the fixed scenario matrix and compares against the baseline. Returns
+// 0 when everything is within tolerance, 1 on regression or error.
+int run_perfcheck(const char* baseline_path, int runs, int update) {
+    const int count = sizeof(perf_scenarios) / sizeof(perf_scenarios[0]);
+    PerfResult results[sizeof(perf_scenarios) / sizeof(perf_scenarios[0])];
 
-        if (sscanf(config->end_time, "%d:%d:%d", &h, &m, &s) == 3) end_seconds = h * 3600 + m * 60 + s;
-        else if (sscanf(config->end_time, "%d:%d", &m, &s) == 2) end_seconds = m * 60 + s;
-        else end_seconds = atof(config->end_time);
+    if (runs < 1) runs = PERFCHECK_DEFAULT_RUNS;
 
-        double duration = end_seconds - start_seconds;
-        if (duration > 0) {
-            snprintf(time_option, sizeof(time_option), "-ss %.3f -t %.3f", start_seconds, duration);
-            printf("⏱️ Time range: %.2fs to %.2fs\n", start_seconds, end_seconds);
+    printf("\n🏁 === PERFORMANCE CHECK (%d runs per scenario) ===\n", runs);
+
+    char* baseline = NULL;
+    double fps_tol = PERFCHECK_FPS_TOLERANCE_PCT, p99_tol = PERFCHECK_P99_TOLERANCE_PCT;
+    if (!update) {
+        baseline = read_text_file(baseline_path);
+        if (!baseline) {
+            printf("❌ Baseline %s not found (record one with -perfcheck-update)\n", baseline_path);
+            return 1;
         }
+        json_scenario_number(baseline, "tolerance", "fps_pct", &fps_tol);
+        json_scenario_number(baseline, "tolerance", "p99_pct", &p99_tol);
     }
 
-    char command[8192];
-    snprintf(command, sizeof(command),
-             "ffmpeg -i \"%s\" %s -vn %s -acodec %s -y \"%s\" 2>&1",
-             fixed_input, time_option, bitrate_opt, codec, final_output);
+    MKDIR(PERFCHECK_CLIP_DIR);
+    MKDIR(PERFCHECK_OUT_DIR);
 
-    printf("\n🔄 Running FFmpeg...\n");
-    fflush(stdout);
+    int regressions = 0;
+    for (int i = 0; i < count; i++) {
+        const PerfScenario* sc = &perf_scenarios[i];
+
+        char clip[512];
+        snprintf(clip, sizeof(clip), "%s" PATH_SEP_STR "synthetic_%dx%d_%d.mp4",
+                 PERFCHECK_CLIP_DIR, sc->width, sc->height, sc->clip_frames);
+        if (access(clip, F_OK) != 0) {
+            printf("   🎞️ Generating %s...\n", clip);
+            if (!generate_synthetic_clip(clip, sc->width, sc->height, sc->clip_frames, 24)) {
+                printf("❌ Cannot generate synthetic clip %s\n", clip);
+                free(baseline);
+                return 1;
+            }
+        }
 
-    FILE* fp = popen(command, "r");
-    if (!fp) { printf("❌ Failed to run FFmpeg\n"); return NULL; }
+        if (!run_perf_scenario(sc, clip, runs, &results[i])) {
+            free(baseline);
+            return 1;
+        }
 
-    char line[256];
-    while (fgets(line, sizeof(line), fp) != NULL) {
-        if (strstr(line, "size=") || strstr(line, "time=")) {
-            char* time_str = strstr(line, "time=");
-            if (time_str) {
-                time_str += 5;
-                char* end = strchr(time_str, ' ');
-                if (end) *end = '\0';
-                printf("\r   ⏱️ %s", time_str);
-                fflush(stdout);
-            }
+        printf("   %-18s %9.1f fps  p99 %8.2f ms", sc->name, results[i].median_fps, results[i].p99_ms);
+
+        double base_fps, base_p99;
+        if (baseline && json_scenario_number(baseline, sc->name, "fps", &base_fps) &&
+            json_scenario_number(baseline, sc->name, "p99_ms", &base_p99)) {
+            double fps_delta = base_fps > 0 ? (results[i].median_fps / base_fps - 1.0) * 100.0 : 0;
+            double p99_delta = base_p99 > 0 ? (results[i].p99_ms / base_p99 - 1.0) * 100.0 : 0;
+            int bad = fps_delta < -fps_tol || p99_delta > p99_tol;
+            printf("  (fps %+.1f%%, p99 %+.1f%%) %s\n", fps_delta, p99_delta, bad ? "❌ REGRESSION" : "✅");
+            regressions += bad;
+        } else if (baseline) {
+            printf("  (no baseline entry)\n");
+        } else {
+            printf("\n");
         }
     }
+    free(baseline);
 
-    int status = pclose(fp);
-    if (status == 0) printf("\n\n✅ Audio extraction complete!\n");
-    else printf("\n\n❌ FFmpeg failed with code %d\n", status);
+    if (update) {
+        if (!perfcheck_write_baseline(baseline_path, results, count)) {
+            printf("❌ Cannot write baseline %s\n", baseline_path);
+            return 1;
+        }
+        printf("\n💾 Baseline written to %s\n", baseline_path);
+        return 0;
+    }
 
-    return NULL;
+    if (regressions > 0) {
+        printf("\n❌ %d scenario%s regressed beyond tolerance (fps -%.0f%%, p99 +%.0f%%)\n",
+               regressions, regressions == 1 ? "" : "s", fps_tol, p99_tol);
+        return 1;
+    }
+    printf("\n✅ No performance regressions\n");
+    return 0;
 }
 
 // ==================== MAIN ====================
@@ -737,13 +6257,21 @@ int main(int argc, char** argv) {
     strcpy(config.output_pattern, "frame_%d.png");
     strcpy(config.audio_output, "audio");
     config.step = 1;
-    config.format = 0;
+    config.format = FORMAT_PNG;
+    config.quality = 80;
+    config.cache_size_gb = 4.0;
+    config.prefetch = -1;
+    config.webp_method = 4;
     config.fast_mode = 0;
     config.extract_audio = 0;
     config.audio_only = 0;
     config.audio_format = 0;
     config.audio_bitrate = 128;
     config.ytdl_download = 0;
+    config.png_level = -1;
+    config.depth = 8;
+    config.perfcheck_runs = PERFCHECK_DEFAULT_RUNS;
+    strcpy(config.perf_baseline, "perf_baseline.json");
 
     printf("\n🎬 Frame Extractor v10.0 (YOUTUBE EDITION)\n");
     printf("==========================================\n");
@@ -772,19 +6300,182 @@ int main(int argc, char** argv) {
         } else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
             parse_frames_string(argv[++i], config.frames, &config.frame_count);
         } else if (strcmp(argv[i], "-range") == 0 && i + 2 < argc) {
-            config.start_frame = atoi(argv[++i]);
-            config.end_frame = atoi(argv[++i]);
+            RangeSegment seg = {0};
+            seg.start_frame = atoi(argv[++i]);
+            seg.end_frame = atoi(argv[++i]);
+            // The first segment also drives -extract-audio and yt-dlp
+            if (config.segment_count == 0) {
+                config.start_frame = seg.start_frame;
+                config.end_frame = seg.end_frame;
+            }
+            if (config.segment_count < MAX_RANGE_SEGMENTS) {
+                config.segments[config.segment_count++] = seg;
+            }
         } else if (strcmp(argv[i], "-step") == 0 && i + 1 < argc) {
             config.step = atoi(argv[++i]);
         } else if (strcmp(argv[i], "-time") == 0 && i + 1 < argc) {
             strcpy(config.time_str, argv[++i]);
             config.use_time = 1;
         } else if (strcmp(argv[i], "-time-range") == 0 && i + 2 < argc) {
-            strcpy(config.start_time, argv[++i]);
-            strcpy(config.end_time, argv[++i]);
-            config.use_time_range = 1;
+            RangeSegment seg = {0};
+            snprintf(seg.start_time, sizeof(seg.start_time), "%s", argv[++i]);
+            snprintf(seg.end_time, sizeof(seg.end_time), "%s", argv[++i]);
+            seg.is_time = 1;
+            if (config.segment_count == 0) {
+                strcpy(config.start_time, seg.start_time);
+                strcpy(config.end_time, seg.end_time);
+                config.use_time_range = 1;
+            }
+            if (config.segment_count < MAX_RANGE_SEGMENTS) {
+                config.segments[config.segment_count++] = seg;
+            }
+        } else if (strcmp(argv[i], "-times") == 0 && i + 1 < argc) {
+            parse_times_string(argv[++i], &config);
+        } else if (strcmp(argv[i], "-times-file") == 0 && i + 1 < argc) {
+            if (!load_times_file(argv[++i], &config)) {
+                printf("❌ Cannot read timestamps from %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-snap") == 0 && i + 1 < argc) {
+            config.snap_nearest = strcmp(argv[++i], "nearest") == 0;
         } else if (strcmp(argv[i], "-fast") == 0) {
             config.fast_mode = 1;
+        } else if (strcmp(argv[i], "-vf") == 0 && i + 1 < argc) {
+            strcpy(config.filter_graph, argv[++i]);
+        } else if (strcmp(argv[i], "-exact-count") == 0) {
+            config.exact_count = 1;
+        } else if (strcmp(argv[i], "-decoder") == 0 && i + 1 < argc) {
+            snprintf(config.decoder, sizeof(config.decoder), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "-depth") == 0 && i + 1 < argc) {
+            config.depth = atoi(argv[++i]) == 16 ? 16 : 8;
+        } else if (strcmp(argv[i], "-tonemap") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "hable") == 0) config.tonemap = TONEMAP_HABLE;
+            else if (strcmp(argv[i], "reinhard") == 0) config.tonemap = TONEMAP_REINHARD;
+            else config.tonemap = TONEMAP_NONE;
+        } else if (strcmp(argv[i], "-no-autorotate") == 0) {
+            config.no_autorotate = 1;
+        } else if (strcmp(argv[i], "-no-sar-correct") == 0) {
+            config.no_sar_correct = 1;
+        } else if (strcmp(argv[i], "-deinterlace") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "fast") == 0) config.deinterlace = DEINTERLACE_FAST;
+            else if (strcmp(argv[i], "bwdif") == 0) config.deinterlace = DEINTERLACE_BWDIF;
+            else config.deinterlace = DEINTERLACE_NONE;
+        } else if (strcmp(argv[i], "-format") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "webp") == 0) {
+#ifdef HAVE_WEBP
+                config.format = FORMAT_WEBP;
+#else
+                printf("⚠️  Built without libwebp (-DHAVE_WEBP), writing PNG\n");
+#endif
+            } else {
+                config.format = FORMAT_PNG;
+            }
+        } else if (strcmp(argv[i], "-quality") == 0 && i + 1 < argc) {
+            config.quality = atoi(argv[++i]);
+            if (config.quality < 0) config.quality = 0;
+            if (config.quality > 100) config.quality = 100;
+        } else if (strcmp(argv[i], "-webp-method") == 0 && i + 1 < argc) {
+            config.webp_method = atoi(argv[++i]);
+            if (config.webp_method < 0) config.webp_method = 0;
+            if (config.webp_method > 6) config.webp_method = 6;
+        } else if (strcmp(argv[i], "-lossless") == 0) {
+            config.lossless = 1;
+        } else if (strcmp(argv[i], "-animate") == 0 && i + 1 < argc) {
+            strcpy(config.animate_path, argv[++i]);
+#ifndef HAVE_WEBP
+            const char* ext = strrchr(config.animate_path, '.');
+            if (ext && strcmp(ext, ".webp") == 0) {
+                printf("❌ Animated WebP needs a -DHAVE_WEBP build\n");
+                return 1;
+            }
+#endif
+        } else if (strcmp(argv[i], "-fps") == 0 && i + 1 < argc) {
+            config.animate_fps = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-scale") == 0 && i + 1 < argc) {
+            config.animate_scale = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-fit") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &config.fit_w, &config.fit_h) != 2 ||
+                config.fit_w <= 0 || config.fit_h <= 0) {
+                config.fit_w = config.fit_h = 0;
+            }
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                i++;
+                if (strcmp(argv[i], "crop") == 0) config.fit_mode = FIT_CROP;
+                else if (strcmp(argv[i], "stretch") == 0) config.fit_mode = FIT_STRETCH;
+                else config.fit_mode = FIT_LETTERBOX;
+            }
+        } else if (strcmp(argv[i], "-pad-color") == 0 && i + 1 < argc) {
+            const char* hex = argv[++i];
+            if (*hex == '#') hex++;
+            unsigned int rgb = (unsigned int)strtoul(hex, NULL, 16);
+            config.pad_color[0] = (uint8_t)(rgb >> 16);
+            config.pad_color[1] = (uint8_t)(rgb >> 8);
+            config.pad_color[2] = (uint8_t)rgb;
+        } else if (strcmp(argv[i], "-tiles") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &config.tile_w, &config.tile_h) != 2 ||
+                config.tile_w <= 0 || config.tile_h <= 0) {
+                config.tile_w = config.tile_h = 0;
+            }
+        } else if (strcmp(argv[i], "-overlap") == 0 && i + 1 < argc) {
+            config.tile_overlap = atoi(argv[++i]);
+            if (config.tile_overlap < 0) config.tile_overlap = 0;
+        } else if (strcmp(argv[i], "-tiles-npy") == 0) {
+            config.tile_batch = 1;
+        } else if (strcmp(argv[i], "-tiles-skip-flat") == 0 && i + 1 < argc) {
+            config.tile_min_variance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-pyramid") == 0 && i + 1 < argc) {
+            config.pyramid = atoi(argv[++i]);
+            if (config.pyramid > MAX_PYRAMID_LEVELS) config.pyramid = MAX_PYRAMID_LEVELS;
+        } else if (strcmp(argv[i], "-passthrough") == 0) {
+            config.passthrough = 1;
+        } else if (strcmp(argv[i], "-png-threads") == 0 && i + 1 < argc) {
+            config.png_threads = atoi(argv[++i]);
+            if (config.png_threads < 0) config.png_threads = 0;
+        } else if (strcmp(argv[i], "-compression") == 0 && i + 1 < argc) {
+            config.png_level = atoi(argv[++i]);
+            if (config.png_level < 0) config.png_level = 0;
+            if (config.png_level > 9) config.png_level = 9;
+        } else if (strcmp(argv[i], "-progress-json") == 0 && i + 1 < argc) {
+            // A file descriptor number (the orchestrator's pipe) or a path
+            const char* target = argv[++i];
+            char* end;
+            long fd = strtol(target, &end, 10);
+            progress_json = *end == '\0' && fd >= 0 ? fdopen(dup((int)fd), "w") : fopen(target, "w");
+            if (!progress_json) {
+                printf("❌ Cannot open progress output %s\n", target);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-frame-cache") == 0 && i + 1 < argc) {
+            snprintf(config.frame_cache, sizeof(config.frame_cache), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "-cache-size") == 0 && i + 1 < argc) {
+            config.cache_size_gb = atof(argv[++i]);
+            if (config.cache_size_gb <= 0) config.cache_size_gb = 4.0;
+        } else if (strcmp(argv[i], "-session") == 0) {
+            config.session = 1;
+        } else if (strcmp(argv[i], "-session-cache") == 0 && i + 1 < argc) {
+            config.session_cache_mb = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-prefetch") == 0 && i + 1 < argc) {
+            config.prefetch = FFMAX(0, FFMIN(atoi(argv[++i]), PREFETCH_MAX));
+        } else if (strcmp(argv[i], "-fingerprint") == 0) {
+            config.fingerprint = 1;
+        } else if (strcmp(argv[i], "-quiet") == 0) {
+            progress_quiet = 1;
+        } else if (strcmp(argv[i], "-profile-alloc") == 0) {
+            config.profile_alloc = 1;
+        } else if (strcmp(argv[i], "-microbench") == 0) {
+            config.microbench = 1;
+        } else if (strcmp(argv[i], "-perfcheck") == 0) {
+            config.perfcheck = 1;
+        } else if (strcmp(argv[i], "-perfcheck-update") == 0) {
+            config.perfcheck = 1;
+            config.perfcheck_update = 1;
+        } else if (strcmp(argv[i], "-perfcheck-runs") == 0 && i + 1 < argc) {
+            config.perfcheck_runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-baseline") == 0 && i + 1 < argc) {
+            strcpy(config.perf_baseline, argv[++i]);
         } else if (strcmp(argv[i], "-extract-audio") == 0) {
             config.extract_audio = 1;
         } else if (strcmp(argv[i], "-audio-only") == 0) {
@@ -800,6 +6491,21 @@ int main(int argc, char** argv) {
         }
     }
 
+    // -quiet: no bar, and stdout's human messages go nowhere. -progress-json 1
+    // still works since it writes to its own duplicate of the descriptor.
+    if (progress_quiet) {
+        fflush(stdout);
+        if (!freopen(NULL_DEVICE, "w", stdout)) return 1;
+    }
+
+    if (config.microbench) {
+        return run_microbench();
+    }
+
+    if (config.perfcheck) {
+        return run_perfcheck(config.perf_baseline, config.perfcheck_runs, config.perfcheck_update);
+    }
+
     // ===== YOUTUBE DOWNLOAD =====
     if (config.ytdl_download) {
         if (!download_from_youtube(&config)) {
@@ -815,219 +6521,37 @@ int main(int argc, char** argv) {
 
     fix_windows_path(config.input);
 
-    // ===== AUDIO-ONLY MODE =====
-    if (config.audio_only) {
-        extract_audio_thread(&config);
-        return 0;
-    }
-
-    // ===== FRAME EXTRACTION =====
-
-    avformat_network_init();
-    AVFormatContext* fmt_ctx = avformat_alloc_context();
-
-    printf("📂 Opening: %s\n", config.input);
-    if (avformat_open_input(&fmt_ctx, config.input, NULL, NULL) != 0) {
-        printf("❌ Error: Cannot open file!\n");
-        return 1;
-    }
-
-    avformat_find_stream_info(fmt_ctx, NULL);
-
-    int video_stream_idx = -1;
-
-    printf("\n🔍 Scanning streams:\n");
-    for (int i = 0; i < fmt_ctx->nb_streams; i++) {
-        AVStream* stream = fmt_ctx->streams[i];
-        const char* type = "unknown";
-
-        if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-            type = "VIDEO";
-            video_stream_idx = i;
-        } else if (stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
-            type = "AUDIO";
-        }
-
-        printf("   Stream %d: %s\n", i, type);
-    }
-
-    if (video_stream_idx == -1) {
-        printf("❌ No video stream found!\n");
-        return 1;
-    }
-
-    AVStream* video_stream = fmt_ctx->streams[video_stream_idx];
-    double fps = av_q2d(video_stream->avg_frame_rate);
-    int total_frames = video_stream->nb_frames;
-    int width = video_stream->codecpar->width;
-    int height = video_stream->codecpar->height;
-
-    printf("\n📹 Video: stream %d, %dx%d, %.2f fps, %d frames\n", 
-           video_stream_idx, width, height, fps, total_frames);
-
-    // ===== FIX FOR VIDEOS WITH NO FRAME COUNT =====
-    if (total_frames <= 0) {
-        printf("\n⚠️  Warning: Video has no frame count in header\n");
-
-        double duration = 0;
-        if (fmt_ctx->duration > 0) {
-            duration = fmt_ctx->duration / (double)AV_TIME_BASE;
-        }
-        if (duration <= 0 && video_stream->duration > 0) {
-            duration = video_stream->duration * av_q2d(video_stream->time_base);
-        }
-
-        if (duration > 0) {
-            double exact_frames = duration * fps;
-            total_frames = (int)ceil(exact_frames);
-            printf("   Duration: %.3f seconds\n", duration);
-            printf("   Calculated frames: %.3f → %d frames\n", exact_frames, total_frames);
-        } else {
-            printf("❌ Cannot determine video duration!\n");
+    if (config.fingerprint) {
+        uint64_t key;
+        if (!input_fingerprint(config.input, &key)) {
+            printf("❌ Cannot read %s\n", config.input);
             return 1;
         }
+        printf("%016llx  %s\n", (unsigned long long)key, config.input);
+        return 0;
     }
 
-    int start_frame = 0, end_frame = total_frames - 1;
-
-    if (config.use_time) {
-        start_frame = parse_time_to_frame(config.time_str, fps);
-        end_frame = start_frame;
-        printf("\n⏱️ Time %s = frame %d\n", config.time_str, start_frame);
-    } else if (config.use_time_range) {
-        start_frame = parse_time_to_frame(config.start_time, fps);
-        end_frame = parse_time_to_frame(config.end_time, fps);
-        printf("\n⏱️ Time range %s to %s = frames %d to %d\n", 
-               config.start_time, config.end_time, start_frame, end_frame);
-    } else if (config.start_frame > 0 || config.end_frame > 0) {
-        if (config.start_frame > 0) start_frame = config.start_frame;
-        if (config.end_frame > 0) end_frame = config.end_frame;
-        printf("\n📹 Frame range: %d to %d\n", start_frame, end_frame);
-    }
-
-    if (start_frame < 0) start_frame = 0;
-    if (end_frame >= total_frames) end_frame = total_frames - 1;
-
-    int frames_to_extract[4096];
-    int extract_count = 0;
-
-    if (config.frame_count > 0) {
-        for (int i = 0; i < config.frame_count; i++) {
-            if (config.frames[i] >= start_frame && config.frames[i] <= end_frame) {
-                frames_to_extract[extract_count++] = config.frames[i];
-            }
-        }
-        printf("📋 Extracting %d specific frames\n", extract_count);
-    } else {
-        for (int f = start_frame; f <= end_frame; f += config.step) {
-            frames_to_extract[extract_count++] = f;
-        }
-        printf("📋 Extracting %d frames (range %d-%d, step %d)\n", 
-               extract_count, start_frame, end_frame, config.step);
-    }
-
-    if (extract_count == 0) {
-        printf("❌ No frames to extract!\n");
-        return 1;
-    }
-
-    const AVCodec* codec = avcodec_find_decoder(video_stream->codecpar->codec_id);
-    AVCodecContext* codec_ctx = avcodec_alloc_context3(codec);
-    avcodec_parameters_to_context(codec_ctx, video_stream->codecpar);
-
-    if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
-        printf("❌ Failed to open video codec\n");
-        return 1;
-    }
-
-    AVFrame* frame = av_frame_alloc();
-
-    if (start_frame > 0) {
-        int64_t seek_pts = av_rescale_q(start_frame, 
-                                        (AVRational){1, (int)fps},
-                                        video_stream->time_base);
-        av_seek_frame(fmt_ctx, video_stream_idx, seek_pts, AVSEEK_FLAG_BACKWARD);
-    }
-
-    FrameQueue frame_queue;
-    queue_init(&frame_queue, width, height, config.format, config.fast_mode, 
-               config.output_pattern, extract_count);
-
-    ProgressTracker progress;
-    progress_init(&progress, extract_count);
-
-    pthread_t saver_threads[NUM_SAVER_THREADS];
-    SaverThreadArgs thread_args[NUM_SAVER_THREADS];
-
-    for (int i = 0; i < NUM_SAVER_THREADS; i++) {
-        thread_args[i].queue = &frame_queue;
-        thread_args[i].progress = &progress;
-        pthread_create(&saver_threads[i], NULL, frame_saver_thread, &thread_args[i]);
-    }
-
-    pthread_t audio_thread;
-    if (config.extract_audio) {
-        pthread_create(&audio_thread, NULL, extract_audio_thread, &config);
+    if (config.session) {
+        return run_session(&config);
     }
 
-    printf("\n🔄 Decoding frames with %d saver threads...\n", NUM_SAVER_THREADS);
-
-    AVPacket packet;
-    int current_frame = 0;
-    int frames_queued = 0;
-    int frames_decoded = 0;
-
-    while (av_read_frame(fmt_ctx, &packet) >= 0 && frames_queued < extract_count) {
-        if (packet.stream_index == video_stream_idx) {
-            avcodec_send_packet(codec_ctx, &packet);
-
-            while (avcodec_receive_frame(codec_ctx, frame) == 0) {
-                if (current_frame >= start_frame && 
-                    current_frame <= end_frame &&
-                    (config.frame_count == 0 || 
-                     frame_in_list(current_frame, frames_to_extract, extract_count))) {
-
-                    queue_push(&frame_queue, frame, current_frame);
-                    frames_queued++;
-                    frames_decoded++;
-
-                    if (frames_decoded % 10 == 0) {
-                        printf("\r📽️ Decoded: %d/%d frames", frames_decoded, extract_count);
-                        fflush(stdout);
-                    }
-                }
-                current_frame++;
-
-                if (frames_queued >= extract_count) break;
-            }
-        }
-        av_packet_unref(&packet);
-
-        if (frames_queued >= extract_count) break;
+    // ===== AUDIO-ONLY MODE =====
+    if (config.audio_only) {
+        extract_audio_thread(&config);
+        return 0;
     }
 
-    printf("\r📽️ Decoded: %d/%d frames - done!\n", frames_decoded, extract_count);
-
-    queue_set_done(&frame_queue);
+    // ===== FRAME EXTRACTION =====
 
-    for (int i = 0; i < NUM_SAVER_THREADS; i++) {
-        pthread_join(saver_threads[i], NULL);
+    int rc = extract_frames(&config, NULL);
+    if (progress_json) {
+        fprintf(progress_json, "{\"event\":\"exit\",\"code\":%d}\n", rc);
+        fflush(progress_json);
     }
-
-    if (config.extract_audio) {
-        pthread_join(audio_thread, NULL);
+    if (rc != 0) {
+        return rc;
     }
 
-    progress_finish(&progress);
-
-    av_frame_free(&frame);
-    avcodec_free_context(&codec_ctx);
-    avformat_close_input(&fmt_ctx);
-    queue_destroy(&frame_queue);
-
-    printf("\n✅ Done! Extracted %d frames using %d threads!\n", 
-           extract_count, NUM_SAVER_THREADS);
-
     // Clean up downloaded file if from YouTube
     if (config.ytdl_download) {
         printf("\n🧹 Cleaning up downloaded file...\n");